@@ -1,6 +1,7 @@
 #include "appsettings.hpp"
 
 using std::string;
+using nlohmann::json;
 
 void AppSettings::load(const std::string& fileName) {
     AppConfigParser parser;
@@ -15,11 +16,16 @@ void AppSettings::save(const std::string& fileName) {
 }
 
 nlohmann::json AppSettings::marshal() const {
+    auto caen = json::array();
+    for(auto& board : caenConfig)
+        caen.push_back(board.marshal());
     return {
         {"address", ip },
         {"port", port },
         {"expo", expoConfig.marshal()},
         {"voltage", voltConfig.marshal()},
+        {"caen", caen},
+        {"expo_tdc", expoTdc},
     };
 }
 
@@ -28,4 +34,17 @@ void AppSettings::unMarshal(const nlohmann::json& doc) {
     port = doc.at("port");
     expoConfig.unMarshal(doc.at("expo"));
     voltConfig.unMarhsal(doc.at("voltage"));
+    //Старые файлы настроек описывают один модуль по адресу 0xEE00
+    caenConfig.clear();
+    if(doc.count("caen") != 0) {
+        for(auto& board : doc.at("caen")) {
+            caenConfig.emplace_back();
+            caenConfig.back().unMarshal(board);
+        }
+        if(caenConfig.empty())
+            throw std::runtime_error("AppSettings::unMarshal caen board list is empty");
+    } else {
+        caenConfig.push_back({0, 0, 0xEE00, 0});
+    }
+    expoTdc = doc.count("expo_tdc") != 0 ? doc.at("expo_tdc").get<string>() : "emiss";
 }
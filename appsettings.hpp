@@ -3,12 +3,16 @@
 #include "configparser/appconfigparser.hpp"
 #include "exposition/exposition.hpp"
 #include "controller/voltagecontroller.hpp"
+#include "tdc/caencrate.hpp"
 
 struct AppSettings {
     std::string ip;
     uint16_t     port;
     Exposition::Settings expoConfig;
     VoltageContr::Config voltConfig;
+    std::vector<CaenCrate::BoardSettings> caenConfig;
+    // Модуль, с которого читает экспозиция: "emiss" или "caen"
+    std::string expoTdc;
 
     void load(const std::string& fileName);
     void save(const std::string& fileName);
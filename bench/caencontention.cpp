@@ -0,0 +1,72 @@
+#include "caenvmemock.hpp"
+#include "tdc/caenv2718.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+using std::vector;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+
+/*
+ * Задержка чтения регистра, пока другой поток выполняет транзакции
+ * микроконтроллера. Шина отпускается на паузы handshake, поэтому чтение
+ * ждет не всю транзакцию, а не дольше нескольких циклов.
+ * Шина и микроконтроллер имитируются: цикл 1 мкс, команда 50 мкс.
+ */
+
+static constexpr size_t samples = 20000;
+
+static void report(const char* name, vector<double>& latency) {
+    std::sort(latency.begin(), latency.end());
+    std::cout << std::setw(24) << std::left << name << std::fixed << std::setprecision(1)
+              << " p50 " << std::setw(8) << latency[latency.size() / 2]
+              << " p99 " << std::setw(8) << latency[latency.size() * 99 / 100]
+              << " max " << latency.back() << " us" << std::endl;
+}
+
+static vector<double> measureReads(CaenV2718& tdc) {
+    vector<double> latency;
+    latency.reserve(samples);
+    for(size_t i = 0; i < samples; ++i) {
+        auto start = steady_clock::now();
+        tdc.eventStored();
+        latency.push_back(std::chrono::duration<double, std::micro>(steady_clock::now() - start).count());
+    }
+    return latency;
+}
+
+int main() {
+    caenmock::reset();
+    caenmock::setTiming(microseconds(1), microseconds(50));
+    CaenV2718 tdc(0xEE00);
+    tdc.open();
+
+    auto idle = measureReads(tdc);
+    report("eventStored idle", idle);
+
+    std::atomic_bool stop(false);
+    uintmax_t transactions = 0;
+    CaenV2718::BusStats total{0, microseconds(0)};
+    std::thread micro([&] {
+        while(!stop) {
+            auto stats = tdc.updateSettings();
+            total.cycles += stats.cycles;
+            total.time += stats.time;
+            ++transactions;
+        }
+    });
+    auto busy = measureReads(tdc);
+    stop = true;
+    micro.join();
+    report("eventStored + micro", busy);
+
+    std::cout << "updateSettings: " << transactions << " transactions, "
+              << double(total.cycles) / transactions << " cycles, "
+              << double(total.time.count()) / transactions << " us each" << std::endl;
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "tdc/emissdecoder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using std::vector;
+
+/*
+ * Масштабирование декодирования E-Miss по потокам: буфер из 4M слов
+ * декодируется с setThreads(n) для n = 1..hardware_concurrency(), как
+ * после EmissTdc::setDecodeThreads(n). Пакеты сверяются с n = 1.
+ */
+
+static constexpr size_t bufferWords = 4 << 20;
+static constexpr int repeats = 10;
+
+//Маркер, 4 слова заголовка, хиты и изредка специальное слово
+static vector<uint32_t> makeBuffer() {
+    std::mt19937 rng(1);
+    vector<uint32_t> data;
+    data.reserve(bufferWords);
+    for(uint32_t trigger = 0; data.size() < bufferWords; ++trigger) {
+        data.insert(data.end(), {0xFFFFFFFF, trigger, 0, 0, 0});
+        for(unsigned h = rng() % 60; h > 0; --h)
+            data.push_back(((rng() % 16) << 16) | ((rng() % 32) << 10) | (rng() % 1024));
+        if(rng() % 10 == 0)
+            data.push_back(0x8000 | (rng() & 0x7FFF));
+    }
+    data.resize(bufferWords);
+    return data;
+}
+
+static bool sameBatch(const EventBatch& a, const EventBatch& b) {
+    if(a.eventCount() != b.eventCount() || a.hitCount() != b.hitCount())
+        return false;
+    for(size_t e = 0; e < a.eventCount(); ++e) {
+        if(a.eventEnd(e) != b.eventEnd(e) || a.trigger(e) != b.trigger(e) || a.specialEnd(e) != b.specialEnd(e))
+            return false;
+    }
+    for(size_t h = 0; h < a.hitCount(); ++h) {
+        if(a.channel(h) != b.channel(h) || a.time(h) != b.time(h))
+            return false;
+    }
+    return true;
+}
+
+int main() {
+    auto data = makeBuffer();
+    auto cores = std::max(1u, std::thread::hardware_concurrency());
+    EmissDecoder decoder;
+    EventBatch reference;
+    EventBatch batch;
+    double single = 0;
+    bool same = true;
+
+    std::cout << std::fixed << std::setprecision(2)
+              << data.size() << " words, isa " << decoder.isa() << ", " << cores << " cores\n";
+    for(unsigned n = 1; n <= cores; ++n) {
+        decoder.setThreads(n);
+        //Лучшее из повторов: первый вызов прогревает пул и память пакета
+        double best = 0;
+        for(int r = 0; r < repeats; ++r) {
+            batch.clear();
+            uint32_t number = 0;
+            auto start = std::chrono::steady_clock::now();
+            decoder.decodeEvents(data.data(), data.size(), 0, number, batch);
+            double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if(r == 0 || time < best)
+                best = time;
+        }
+        if(n == 1) {
+            single = best;
+            reference = batch;
+        } else if(!sameBatch(reference, batch)) {
+            same = false;
+        }
+        std::cout << "threads " << std::setw(2) << n << ": "
+                  << std::setw(7) << best * 1e3 << " ms, "
+                  << std::setw(7) << data.size() / best / 1e6 << " Mword/s, speedup "
+                  << single / best << std::endl;
+    }
+    std::cout << reference.eventCount() << " events, " << reference.hitCount() << " hits, batches "
+              << (same ? "identical" : "DIFFER") << std::endl;
+    return same ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#include "exposition/eventwriter.hpp"
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+using std::string;
+using std::vector;
+using trek::data::EventHits;
+using trek::data::HitRecord;
+
+/*
+ * Запись набора по событию (writeEvent, путь NEVOD) и пакетами
+ * (writeEvents, конвейер). Пакет - 2000 событий, как одно чтение модуля.
+ * Файлы обоих способов должны совпадать побайтно.
+ * Аргумент - каталог для файлов, по умолчанию текущий.
+ */
+
+static constexpr size_t eventCount = 200000;
+static constexpr size_t batchSize = 2000;
+static constexpr unsigned eventsPerFile = 50000;
+
+struct Package {
+    EventBatch batch;
+    vector<EventHits> events;
+};
+
+static string slurp(const string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    string dir = argc > 1 ? argv[1] : ".";
+    auto eventDir = dir + "/event";
+    auto batchDir = dir + "/batch";
+    ::mkdir(eventDir.c_str(), 0755);
+    ::mkdir(batchDir.c_str(), 0755);
+
+    std::mt19937 rng(3);
+    vector<Package> packages(eventCount / batchSize);
+    size_t hits = 0;
+    for(size_t p = 0; p < packages.size(); ++p) {
+        auto& pkg = packages[p];
+        for(size_t e = 0; e < batchSize; ++e) {
+            EventHeader header{};
+            for(auto& word : header.words)
+                word = uint32_t(rng());
+            pkg.batch.beginEvent(uint32_t(p*batchSize + e), int64_t(p), header);
+            for(unsigned s = rng() % 3; s > 0; --s)
+                pkg.batch.addSpecial(0x80000000 | rng());
+            EventHits event;
+            for(unsigned h = rng() % 20; h > 0; --h) {
+                event.emplace_back(HitRecord::Type::leading, rng() % 4, rng() % 100, rng() % 8000);
+                pkg.batch.addHit(0, 0, 0);
+            }
+            hits += event.size();
+            pkg.events.push_back(std::move(event));
+        }
+    }
+
+    double eventTime;
+    {
+        EventWriter writer(eventDir, "bench_", eventsPerFile);
+        unsigned nEvent = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(auto& pkg : packages) {
+            for(size_t e = 0; e < pkg.batch.eventCount(); ++e)
+                writer.writeEvent({1, nEvent++, pkg.events[e]}, pkg.batch, e);
+        }
+        eventTime = seconds(start);
+    }
+    //writeEvents забирает хиты, копии готовятся до замера
+    auto events = packages;
+    double batchTime;
+    {
+        EventWriter writer(batchDir, "bench_", eventsPerFile);
+        auto start = std::chrono::steady_clock::now();
+        for(auto& pkg : events)
+            writer.writeEvents(1, pkg.batch, pkg.events);
+        batchTime = seconds(start);
+    }
+
+    size_t bytes = 0;
+    bool same = true;
+    for(unsigned f = 0; f < eventCount / eventsPerFile; ++f) {
+        for(auto extension : {".tds", ".tdt"}) {
+            std::ostringstream name;
+            name << "/bench_" << std::setw(9) << std::setfill('0') << f << extension;
+            auto a = slurp(eventDir + name.str());
+            auto b = slurp(batchDir + name.str());
+            bytes += a.size();
+            same = same && !a.empty() && a == b;
+        }
+    }
+    std::cout << eventCount << " events, " << hits << " hits, " << bytes / 1e6 << " MB\n"
+              << "writeEvent:  " << eventCount / eventTime / 1e6 << " Mevent/s, "
+              << bytes / eventTime / 1e6 << " MB/s\n"
+              << "writeEvents: " << eventCount / batchTime / 1e6 << " Mevent/s, "
+              << bytes / batchTime / 1e6 << " MB/s\n"
+              << "files " << (same ? "identical" : "DIFFER") << std::endl;
+    return same ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include "exposition/eventmapper.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+using std::vector;
+using trek::data::EventHits;
+
+/*
+ * Преобразование каналов и счет хитов: прежние два прохода (HitRecord,
+ * затем счет по записанным хитам) и совмещенный mapEvent() этапа
+ * преобразования. Таблица на 512 каналов, каждый 17-й не сопоставлен.
+ */
+
+static constexpr size_t events = 20000;
+static constexpr int repeats = 50;
+
+static void convertEvent(const ChannelTable& channels, const EventBatch& batch, size_t event,
+                         uintmax_t& unmapped, EventHits& hits) {
+    hits.clear();
+    for(auto h = batch.eventBegin(event); h < batch.eventEnd(event); ++h) {
+        auto c = channels.find(batch.channel(h));
+        if(c == nullptr) {
+            ++unmapped;
+            continue;
+        }
+        hits.emplace_back(convertEdgeDetection(Tdc::EdgeDetection(batch.edge(h))), c->wire, c->chamber, batch.time(h));
+    }
+}
+
+static void countEvent(const EventHits& hits, RunCounters::Batch& counts) {
+    for(auto& hit : hits)
+        counts.addHit(hit.chamber(), hit.wire());
+    counts.addTriggers(1);
+}
+
+int main() {
+    ChannelConfig config;
+    for(unsigned ch = 0; ch < 512; ++ch) {
+        if(ch % 17 != 0)
+            config.insert({ch, {ch / 4, ch % 4}});
+    }
+    ChannelTable channels(config);
+
+    std::mt19937 rng(1);
+    EventBatch batch;
+    size_t hits = 0;
+    for(size_t e = 0; e < events; ++e) {
+        batch.beginEvent(uint32_t(e), 0);
+        for(unsigned h = rng() % 40; h > 0; --h, ++hits)
+            batch.addHit(rng() % 520, rng() % 8000, 0);
+    }
+    vector<EventHits> mapped(batch.eventCount());
+
+    RunCounters::Batch twoPass;
+    twoPass.reset(channels.chambers());
+    uintmax_t unmapped = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < repeats; ++r) {
+        for(size_t e = 0; e < batch.eventCount(); ++e) {
+            convertEvent(channels, batch, e, unmapped, mapped[e]);
+            countEvent(mapped[e], twoPass);
+        }
+    }
+    twoPass.addUnmapped(unmapped);
+    double twoPassTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    RunCounters::Batch fused;
+    fused.reset(channels.chambers());
+    start = std::chrono::steady_clock::now();
+    for(int r = 0; r < repeats; ++r) {
+        for(size_t e = 0; e < batch.eventCount(); ++e)
+            mapEvent(channels, batch, e, fused, mapped[e]);
+    }
+    double fusedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    //Счет сравнивается через счетчики набора
+    RunCounters a, b;
+    a.reset(channels.chambers());
+    b.reset(channels.chambers());
+    a.add(twoPass);
+    b.add(fused);
+    auto sa = a.snapshot();
+    auto sb = b.snapshot();
+    bool same = sa.triggers == sb.triggers && sa.unmapped == sb.unmapped && sa.chambers == sb.chambers;
+
+    std::cout << std::fixed << std::setprecision(1)
+              << events << " events, " << hits << " hits\n"
+              << "two-pass: " << hits * repeats / twoPassTime / 1e6 << " Mhit/s\n"
+              << "fused:    " << hits * repeats / fusedTime / 1e6 << " Mhit/s\n"
+              << "counters " << (same ? "identical" : "DIFFER") << std::endl;
+    return same ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+#include "emiss/transferbuffer.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/*
+ * Подготовка буфера к чтению EMISS: прежний std::vector, который перед
+ * каждой передачей увеличивался до 16M слов с обнулением, и TransferBuffer,
+ * выделенный один раз. В обоих случаях принятые слова копируются в буфер,
+ * как это делает передача USB.
+ */
+
+static constexpr size_t bufferWords = 16*1024*1024;
+static constexpr int reads = 50;
+
+template<typename F>
+static double perRead(F read) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < reads; ++i)
+        read();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / reads;
+}
+
+int main() {
+    std::vector<uint32_t> source(4*1024*1024, 0xA5A5A5A5);
+    std::vector<uint32_t> vector;
+    vector.reserve(bufferWords);
+    TransferBuffer buffer(bufferWords);
+    volatile uint32_t sink = 0;
+
+    std::cout << std::fixed << std::setprecision(2);
+    for(size_t words : {size_t(64*1024), size_t(1024*1024), size_t(4*1024*1024)}) {
+        auto resize = perRead([&] {
+            vector.resize(bufferWords);
+            std::memcpy(vector.data(), source.data(), words*sizeof(uint32_t));
+            vector.resize(words);
+            sink = sink + vector[words - 1];
+        });
+        auto reuse = perRead([&] {
+            std::memcpy(buffer.data(), source.data(), words*sizeof(uint32_t));
+            buffer.setSize(words);
+            sink = sink + buffer[words - 1];
+        });
+        std::cout << std::setw(8) << words << " words: vector resize " << resize
+                  << " ms, TransferBuffer " << reuse << " ms per read" << std::endl;
+    }
+    return 0;
+}
@@ -19,6 +19,17 @@ Controller::Methods EmissContr::createMethods() {
         {"isOpen",                [&](auto & request, auto & send) { return this->isOpen(request, send); } },
         {"stat",                  [&](auto& request, auto& send)   { return this->stat(request, send); } },
         {"clear",                 [&](auto & request, auto & send) { return this->clear(request, send); } },
+        {"setStreaming",          [&](auto & request, auto & send) { return this->setStreaming(request, send); } },
+        {"streaming",             [&](auto & request, auto & send) { return this->streaming(request, send); } },
+        {"setDecodeThreads",      [&](auto & request, auto & send) { return this->setDecodeThreads(request, send); } },
+        {"decodeThreads",         [&](auto & request, auto & send) { return this->decodeThreads(request, send); } },
+        {"gateStats",             [&](auto & request, auto & send) { return this->gateStats(request, send); } },
+        {"setBufferBudget",       [&](auto & request, auto & send) { return this->setBufferBudget(request, send); } },
+        {"bufferBudget",          [&](auto & request, auto & send) { return this->bufferBudget(request, send); } },
+        {"setTriggerWord",        [&](auto & request, auto & send) { return this->setTriggerWord(request, send); } },
+        {"triggerWord",           [&](auto & request, auto & send) { return this->triggerWord(request, send); } },
+        {"decodeStats",           [&](auto & request, auto & send) { return this->decodeStats(request, send); } },
+        {"busStats",              [&](auto & request, auto & send) { return this->busStats(request, send); } },
     };
 }
 
@@ -38,6 +49,64 @@ void EmissContr::isOpen(const Request&, const SendCallback& send) {
     send({ name(), __func__, {mDevice->isOpen()} });
 }
 
+void EmissContr::setStreaming(const Request& request, const SendCallback& send) {
+    if(request.inputs.at(0).get<bool>())
+        mDevice->startStream();
+    else
+        mDevice->stopStream();
+    send({ name(), __func__ });
+    handleRequest({name(), "streaming"}, mBroadcast);
+}
+
+void EmissContr::streaming(const Request&, const SendCallback& send) {
+    send({ name(), __func__, {mDevice->isStreaming()} });
+}
+
+void EmissContr::setDecodeThreads(const Request& request, const SendCallback& send) {
+    mDevice->setDecodeThreads(request.inputs.at(0));
+    send({ name(), __func__ });
+    handleRequest({name(), "decodeThreads"}, mBroadcast);
+}
+
+void EmissContr::decodeThreads(const Request&, const SendCallback& send) {
+    send({ name(), __func__, {mDevice->decodeThreads()} });
+}
+
+void EmissContr::gateStats(const Request&, const SendCallback& send) {
+    auto stats = mDevice->gateStats();
+    send({ name(), __func__, {stats.last.count(), stats.closed.count(), stats.elapsed.count()} });
+}
+
+void EmissContr::setBufferBudget(const Request& request, const SendCallback& send) {
+    mDevice->setBufferBudget(request.inputs.at(0).get<size_t>());
+    send({ name(), __func__ });
+    handleRequest({name(), "bufferBudget"}, mBroadcast);
+}
+
+void EmissContr::bufferBudget(const Request&, const SendCallback& send) {
+    send({ name(), __func__, {mDevice->bufferBudget()} });
+}
+
+void EmissContr::setTriggerWord(const Request& request, const SendCallback& send) {
+    mDevice->setTriggerWord(request.inputs.at(0).get<int>());
+    send({ name(), __func__ });
+    handleRequest({name(), "triggerWord"}, mBroadcast);
+}
+
+void EmissContr::triggerWord(const Request&, const SendCallback& send) {
+    send({ name(), __func__, {mDevice->triggerWord()} });
+}
+
+void EmissContr::decodeStats(const Request&, const SendCallback& send) {
+    auto stats = mDevice->decodeStats();
+    send({ name(), __func__, {stats.events, stats.gaps, stats.lost, stats.truncated} });
+}
+
+void EmissContr::busStats(const Request&, const SendCallback& send) {
+    auto stats = mDevice->busStats();
+    send({ name(), __func__, {stats.syscalls, stats.operations, stats.readsAvoided, stats.writesAvoided, stats.statusPolls} });
+}
+
 void EmissContr::clear(const Request&, const SendCallback& send) {
     mDevice->clear();
     send({ name(), __func__ });
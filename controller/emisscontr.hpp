@@ -15,6 +15,17 @@ protected:
     void open(const trek::net::Request& request, const SendCallback& send);
     void close(const trek::net::Request& request, const SendCallback& send);
     void isOpen(const trek::net::Request& request, const SendCallback& send);
+    void setStreaming(const trek::net::Request& request, const SendCallback& send);
+    void streaming(const trek::net::Request& request, const SendCallback& send);
+    void setDecodeThreads(const trek::net::Request& request, const SendCallback& send);
+    void decodeThreads(const trek::net::Request& request, const SendCallback& send);
+    void gateStats(const trek::net::Request& request, const SendCallback& send);
+    void setBufferBudget(const trek::net::Request& request, const SendCallback& send);
+    void bufferBudget(const trek::net::Request& request, const SendCallback& send);
+    void setTriggerWord(const trek::net::Request& request, const SendCallback& send);
+    void triggerWord(const trek::net::Request& request, const SendCallback& send);
+    void decodeStats(const trek::net::Request& request, const SendCallback& send);
+    void busStats(const trek::net::Request& request, const SendCallback& send);
 
     void clear(const trek::net::Request& request, const SendCallback& send);
     void reset(const trek::net::Request& request, const SendCallback& send);
@@ -8,6 +8,8 @@
 
 #include <json.hpp>
 
+#include <algorithm>
+
 using std::make_unique;
 using std::string;
 using std::ostringstream;
@@ -44,16 +46,29 @@ static auto convertFreq(const TrekFreq& freq) {
     return convert(freq, "freq");
 }
 
-static auto convertHitCount(const TrekHitCount& count) {
-    return convert(count, "count");
+//Камеры без хитов не передаются
+static auto convertHitCount(const std::vector<ChamberHitCount>& count) {
+    json::array_t jCount;
+    for(unsigned chamber = 0; chamber < count.size(); ++chamber) {
+        auto& wires = count[chamber];
+        if(std::all_of(wires.begin(), wires.end(), [](auto n) { return n == 0; }))
+            continue;
+        jCount.push_back({
+            {"chamber", chamber},
+            {"count",   wires},
+        });
+    }
+    return jCount;
 }
 
 ExpoContr::ExpoContr(const std::string& name,
                      const ModulePtr& module,
                      const Exposition::Settings& settings,
-                     const ChannelConfig& config)
+                     const ChannelConfig& config,
+                     const std::vector<ModulePtr>& metaModules)
     : Controller(name, createMethods()),
       mDevice(module),
+      mMetaModules(metaModules),
       mChannelConfig(config),
       mConfig(settings) { }
 
@@ -76,6 +91,8 @@ Controller::Methods ExpoContr::createMethods() {
         {"triggerCount", [&](auto & request, auto & send) { return this->triggerCount(request, send); } },
         {"packageCount", [&](auto & request, auto & send) { return this->packageCount(request, send); } },
         {"chambersCount",[&](auto & request, auto & send) { return this->chambersCount(request, send); } },
+        {"queueStats",   [&](auto & request, auto & send) { return this->queueStats(request, send); } },
+        {"unmappedHits", [&](auto & request, auto & send) { return this->unmappedHits(request, send); } },
         {"freq",         [&](auto & request, auto & send) { return this->freq(request, send); } },
     };
 }
@@ -94,7 +111,7 @@ void ExpoContr::launchRead(const Request& request, const SendCallback& send) {
     assert(!mExposition);
     mExposition = make_unique<Exposition>(mDevice, mConfig, mChannelConfig, [this](TrekFreq freq) {
         mBroadcast({name(), "freq", {convertFreq(freq)}});
-    });
+    }, mMetaModules);
     send({ name(), __func__ });
     handleRequest({ name(), "type"}, mBroadcast);
     handleRequest({ name(), "run"}, mBroadcast);
@@ -126,7 +143,7 @@ void ExpoContr::launchFreq(const Request& request, const SendCallback& send) {
 void ExpoContr::stopFreq(const Request& request, const SendCallback& send) {
     if(!mFreqFuture)
         throw logic_error("ExpoContr::stopFreq process is not active");
-    mFreq = ::convertFreq(mFreqFuture(), mChannelConfig);
+    mFreq = ::convertFreq(mFreqFuture(), ChannelTable(mChannelConfig));
     mFreqFuture = nullptr;
 
     handleRequest({ name(), "type"}, mBroadcast);
@@ -137,25 +154,44 @@ void ExpoContr::triggerCount(const Request& request, const SendCallback& send) c
     if(!mExposition)
         throw runtime_error("ExpoContr::triggerCount process is not expo");
     assert(*mExposition);
-    send({ name(), __func__, {mExposition->triggerCount(), mExposition->triggerDrop()} });
+    send({ name(), __func__, {mExposition->counters().triggers, mExposition->dropCounters().triggers} });
 }
 
 void ExpoContr::packageCount(const Request& request, const SendCallback& send) const {
     if(!mExposition)
         throw runtime_error("ExpoContr::packageCount process is not expo");
     assert(*mExposition);
-    send({ name(), __func__, {mExposition->packageCount(), mExposition->packageDrop()} });
+    send({ name(), __func__, {mExposition->counters().packages, mExposition->dropCounters().packages} });
 }
 
 void ExpoContr::chambersCount(const Request& request, const SendCallback& send) const {
     if(!mExposition)
         throw runtime_error("ExpoContr::packageCount process is not expo");
     assert(*mExposition);
-    auto count = convertHitCount(mExposition->chambersCount());
-    auto drop  = convertHitCount(mExposition->chamberDrop());
+    auto count = convertHitCount(mExposition->counters().chambers);
+    auto drop  = convertHitCount(mExposition->dropCounters().chambers);
     send({ name(), __func__, {count, drop} });
 }
 
+void ExpoContr::queueStats(const Request& request, const SendCallback& send) const {
+    if(!mExposition)
+        throw runtime_error("ExpoContr::queueStats process is not expo");
+    assert(*mExposition);
+    auto toJson = [](const Exposition::QueueStats& q) {
+        return json::array({q.depth, q.highWater, q.capacity, q.stalls});
+    };
+    send({ name(), __func__, {toJson(mExposition->decodeQueueStats()),
+                              toJson(mExposition->mapQueueStats()),
+                              toJson(mExposition->writeQueueStats())} });
+}
+
+void ExpoContr::unmappedHits(const Request& request, const SendCallback& send) const {
+    if(!mExposition)
+        throw runtime_error("ExpoContr::unmappedHits process is not expo");
+    assert(*mExposition);
+    send({ name(), __func__, {mExposition->counters().unmapped} });
+}
+
 void ExpoContr::freq(const Request& request, const SendCallback& send) const {
     send({ name(), __func__, convertFreq(mFreq) });
 }
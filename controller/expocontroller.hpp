@@ -18,7 +18,8 @@ public:
     ExpoContr(const std::string& name,
                    const ModulePtr& module,
                    const Exposition::Settings& settings,
-                   const ChannelConfig& config);
+                   const ChannelConfig& config,
+                   const std::vector<ModulePtr>& metaModules = {});
     ~ExpoContr();
     const trek::Callback<void(unsigned)>& onNewRun();
 protected:
@@ -33,6 +34,8 @@ protected:
     void packageCount(const trek::net::Request& request, const SendCallback& send) const;
     void droppedCount(const trek::net::Request& request, const SendCallback& send) const;
     void chambersCount(const trek::net::Request& request, const SendCallback& send) const;
+    void queueStats(const trek::net::Request& request, const SendCallback& send) const;
+    void unmappedHits(const trek::net::Request& request, const SendCallback& send) const;
     void freq(const trek::net::Request& request, const SendCallback& send) const;
 
     std::string getProcessType() const;
@@ -41,6 +44,7 @@ private:
     std::unique_ptr<Exposition> mExposition;
     FreqFuture mFreqFuture;
     ModulePtr     mDevice;
+    std::vector<ModulePtr> mMetaModules;
     ChannelConfig mChannelConfig;
     mutable TrekFreq mFreq;
 
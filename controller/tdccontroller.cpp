@@ -1,6 +1,7 @@
 #include "tdccontroller.hpp"
 
 using std::string;
+using std::chrono::microseconds;
 
 using nlohmann::json;
 
@@ -10,7 +11,8 @@ using trek::net::Controller;
 
 Caen2718Contr::Caen2718Contr(const std::string& name, const ModulePtr& module)
     : Controller(name, createMethods()),
-      mDevice(module) { }
+      mDevice(module),
+      mBusStats{0, microseconds::zero()} { }
 
 Controller::Methods Caen2718Contr::createMethods() {
     return {
@@ -30,8 +32,18 @@ Controller::Methods Caen2718Contr::createMethods() {
         {"setLsb",                [&](auto & request, auto & send) { return this->setLsb(request, send);  } },
         {"setCtrl",               [&](auto & request, auto & send) { return this->setCtrl(request, send); } },
         {"setTdcMeta",            [&](auto & request, auto & send) { return this->setTdcMeta(request, send); } },
+        {"setStreaming",          [&](auto & request, auto & send) { return this->setStreaming(request, send); } },
+        {"streaming",             [&](auto & request, auto & send) { return this->streaming(request, send); } },
+        {"setAlmostFull",         [&](auto & request, auto & send) { return this->setAlmostFull(request, send); } },
+        {"almostFull",            [&](auto & request, auto & send) { return this->almostFull(request, send); } },
+        {"setInterruptLevel",     [&](auto & request, auto & send) { return this->setInterruptLevel(request, send); } },
+        {"interruptLevel",        [&](auto & request, auto & send) { return this->interruptLevel(request, send); } },
+        {"setTransferMode",       [&](auto & request, auto & send) { return this->setTransferMode(request, send); } },
+        {"transferMode",          [&](auto & request, auto & send) { return this->transferMode(request, send); } },
+        {"triggerStats",          [&](auto & request, auto & send) { return this->triggerStats(request, send); } },
         {"settings",              [&](auto & request, auto & send) { return this->settings(request, send); } },
         {"updateSettings",        [&](auto & request, auto & send) { return this->updateSettings(request, send); } },
+        {"busStats",              [&](auto & request, auto & send) { return this->busStats(request, send); } },
     };
 }
 
@@ -105,6 +117,54 @@ void Caen2718Contr::setTdcMeta(const Request& request, const SendCallback& send)
     handleRequest({name(), "tdcMeta"}, mBroadcast);
 }
 
+void Caen2718Contr::setStreaming(const Request& request, const SendCallback& send) {
+    if(request.inputs.at(0).get<bool>())
+        mDevice->startStream();
+    else
+        mDevice->stopStream();
+    send({ name(), __func__ });
+    handleRequest({name(), "streaming"}, mBroadcast);
+}
+
+void Caen2718Contr::streaming(const Request& request, const SendCallback& send) {
+    send({ name(), __func__, {mDevice->isStreaming()} });
+}
+
+void Caen2718Contr::setAlmostFull(const Request& request, const SendCallback& send) {
+    mDevice->setAlmostFull(request.inputs.at(0));
+    send({ name(), __func__ });
+    handleRequest({name(), "almostFull"}, mBroadcast);
+}
+
+void Caen2718Contr::almostFull(const Request& request, const SendCallback& send) {
+    send({ name(), __func__, {mDevice->almostFull()} });
+}
+
+void Caen2718Contr::setInterruptLevel(const Request& request, const SendCallback& send) {
+    mDevice->setInterruptLevel(request.inputs.at(0));
+    send({ name(), __func__ });
+    handleRequest({name(), "interruptLevel"}, mBroadcast);
+}
+
+void Caen2718Contr::interruptLevel(const Request& request, const SendCallback& send) {
+    send({ name(), __func__, {mDevice->interruptLevel()} });
+}
+
+void Caen2718Contr::setTransferMode(const Request& request, const SendCallback& send) {
+    auto mode = request.inputs.at(0).get<int>();
+    mDevice->setTransferMode(Module::TransferMode(mode));
+    send({ name(), __func__ });
+    handleRequest({name(), "transferMode"}, mBroadcast);
+}
+
+void Caen2718Contr::transferMode(const Request& request, const SendCallback& send) {
+    send({ name(), __func__, {int(mDevice->transferMode())} });
+}
+
+void Caen2718Contr::triggerStats(const Request& request, const SendCallback& send) {
+    send({ name(), __func__, {mDevice->triggerGaps(), mDevice->lostTriggers(), mDevice->counterMismatches()} });
+}
+
 void Caen2718Contr::stat(const Request& request, const SendCallback& send) {
     send({ name(), __func__, {mDevice->stat()} });
 }
@@ -121,8 +181,9 @@ void Caen2718Contr::mode(const Request& request, const SendCallback& send) {
     send({ name(), __func__, {int(mDevice->mode())} });
 }
 
+//Кроме настроек возвращает циклы VME и время транзакции в мкс
 void Caen2718Contr::updateSettings(const Request& request, const SendCallback& send) {
-    mDevice->updateSettings();
+    mBusStats = mDevice->updateSettings();
     auto settings = mDevice->settings();
     send({
         name(), __func__,
@@ -131,6 +192,8 @@ void Caen2718Contr::updateSettings(const Request& request, const SendCallback& s
             settings.windowOffset,
             int(settings.edgeDetection),
             settings.lsb,
+            mBusStats.cycles,
+            mBusStats.time.count(),
         })
     });
 }
@@ -147,3 +210,7 @@ void Caen2718Contr::settings(const Request& request, const SendCallback& send) {
         })
     });
 }
+
+void Caen2718Contr::busStats(const Request& request, const SendCallback& send) {
+    send({ name(), __func__, {mBusStats.cycles, mBusStats.time.count()} });
+}
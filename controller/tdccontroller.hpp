@@ -29,8 +29,20 @@ protected:
     void setLsb(const trek::net::Request& request, const SendCallback& send);
     void setCtrl(const trek::net::Request& request, const SendCallback& send);
     void setTdcMeta(const trek::net::Request& request, const SendCallback& send);
+    void setStreaming(const trek::net::Request& request, const SendCallback& send);
+    void setAlmostFull(const trek::net::Request& request, const SendCallback& send);
+    void almostFull(const trek::net::Request& request, const SendCallback& send);
+    void setInterruptLevel(const trek::net::Request& request, const SendCallback& send);
+    void interruptLevel(const trek::net::Request& request, const SendCallback& send);
+    void setTransferMode(const trek::net::Request& request, const SendCallback& send);
+    void transferMode(const trek::net::Request& request, const SendCallback& send);
+    void triggerStats(const trek::net::Request& request, const SendCallback& send);
+    void streaming(const trek::net::Request& request, const SendCallback& send);
     void updateSettings(const trek::net::Request& request, const SendCallback& send);
     void settings(const trek::net::Request& request, const SendCallback& send);
+    void busStats(const trek::net::Request& request, const SendCallback& send);
 private:
     ModulePtr mDevice;
+    // Последняя транзакция updateSettings
+    Module::BusStats mBusStats;
 };
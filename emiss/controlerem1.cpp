@@ -1,14 +1,37 @@
 #include "controlerem1.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 using std::vector;
 using std::string;
 using std::unordered_set;
 using std::runtime_error;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+//Опросы без паузы, затем пауза удваивается от pollMinDelay до pollMaxDelay
+static constexpr int          pollSpins = 64;
+static constexpr microseconds pollMinDelay(10);
+static constexpr microseconds pollMaxDelay(1000);
+static constexpr milliseconds pollTimeout(1000);
+
+static constexpr long STATUS_REG    = 0;
+static constexpr long INTERRUPT_REG = 04;
+static constexpr long CONTROL_REG   = 06;
+static constexpr long TYPE_REG      = 011;
 
 ContrEM1::ContrEM1(long baseAddress)
-    : mBaseAddress(baseAddress) { }
+    : mBaseAddress(baseAddress),
+      mShadow(),
+      mReadsAvoided(0),
+      mWritesAvoided(0),
+      mStatusPolls(0) { }
 
 void ContrEM1::open(const string& devName) {
+    invalidateShadow();
     mQbusDev.open(devName);
     mQbusDev.clearErrorStatus();
     mQbusDev.resetBranch();
@@ -24,6 +47,7 @@ bool ContrEM1::isOpen() const {
 }
 
 void ContrEM1::resetQbus() {
+    invalidateShadow();
     mQbusDev.resetBranch();
 }
 
@@ -40,6 +64,7 @@ uint16_t ContrEM1::readStatus() {
 }
 
 void ContrEM1::totalReset() {
+    invalidateShadow();
     writeStatus(0b1000000000000000);
 }
 
@@ -68,20 +93,20 @@ uint16_t ContrEM1::readAddressToRead() {
 }
 
 void ContrEM1::writeControl(uint16_t code) {
-    writeWord(06, code);
+    writeShadowed(CONTROL_REG, code);
     mControlReg = code;
 }
 
 uint16_t ContrEM1::readControl() {
-    return readWord(06);
+    return readShadowed(CONTROL_REG);
 }
 
 void ContrEM1::writeInterrupt(uint16_t code) {
-    writeWord(04, code);
+    writeShadowed(INTERRUPT_REG, code);
 }
 
 uint16_t ContrEM1::readInterrupt() {
-    return readWord(04);
+    return readShadowed(INTERRUPT_REG);
 }
 
 void ContrEM1::write(uint16_t nmModul, uint16_t addr, uint16_t data) {
@@ -137,15 +162,16 @@ void ContrEM1::setAR() {
 }
 
 unordered_set<int> ContrEM1::readNumberPch() {
-    bool f_ready;
-    int pch_st;
-
-    totalReset();
-    setPCHN();
-    do {
-        pch_st = readStatusPch();
-        f_ready = (pch_st & 040000) >> 14;
-    } while(f_ready == 0);      // wait PCH READY bit
+    //totalReset() и setPCHN() одним пакетом
+    invalidateShadow();
+    mControlReg = (mControlReg & 0b00111111) | 0b01000000;
+    updateShadow(CONTROL_REG, mControlReg);
+    mBatch.assign({
+        {Operation::write, STATUS_REG,  0b1000000000000000},
+        {Operation::write, CONTROL_REG, mControlReg},
+    });
+    execute(mBatch);
+    int pch_st = waitStatusPch();
 
     int wq    =  pch_st & 03777;            // amount of words
     int errfl = (pch_st & 0100000) >> 15;   // error flags
@@ -155,16 +181,36 @@ unordered_set<int> ContrEM1::readNumberPch() {
     if(wq > 20)
         throw runtime_error("ContrEM1::readNumberPch too many modules\n");
 
+    //Чтения адресной памяти ПЧ выполняются одним блочным чтением
+    mBatch.assign(wq, {Operation::read, 014, 0});
+    execute(mBatch);
     unordered_set<int> modules;
-    for(int i = 0; i < wq; i++) {
-        int mnum = readAddressPch() & 037;
+    for(auto& op : mBatch) {
+        int mnum = op.word & 037;
         modules.insert(mnum);
     }
     return modules;
 }
 
+uint16_t ContrEM1::waitStatusPch() {
+    auto deadline = steady_clock::now() + pollTimeout;
+    auto delay = pollMinDelay;
+    for(int poll = 0;; ++poll) {
+        ++mStatusPolls;
+        auto pch_st = readStatusPch();
+        if(pch_st & 040000)             // PCH READY bit
+            return pch_st;
+        if(poll < pollSpins)
+            continue;
+        if(steady_clock::now() > deadline)
+            throw runtime_error("ContrEM1::readNumberPch PCH ready timeout");
+        std::this_thread::sleep_for(delay);
+        delay = std::min(2*delay, pollMaxDelay);
+    }
+}
+
 void ContrEM1::setTypeSignal(uint16_t codeOutSignal) {
-    writeWord(011, codeOutSignal & 0x7);
+    writeShadowed(TYPE_REG, codeOutSignal & 0x7);
 }
 
 void ContrEM1::generateSignal(uint16_t nmOut) {
@@ -180,3 +226,71 @@ void ContrEM1::generateSignal(TypeSignal sType, uint16_t nmOut) {
     setTypeSignal( uint16_t(sType) << nmOut );
     generateSignal(nmOut);
 }
+
+void ContrEM1::generateSignals(std::initializer_list<std::pair<TypeSignal, uint16_t>> signals) {
+    mBatch.clear();
+    for(auto& s : signals) {
+        uint16_t type = (uint16_t(s.first) << s.second) & 0x7;
+        if(updateShadow(TYPE_REG, type))
+            mBatch.push_back({Operation::write, TYPE_REG, type});
+        mBatch.push_back({Operation::write, 012, uint16_t(s.second & 0x3)});
+    }
+    execute(mBatch);
+}
+
+void ContrEM1::execute(vector<Operation>& operations) {
+    try {
+        mQbusDev.execute(operations, mBaseAddress);
+    } catch(...) {
+        //Неизвестно, какие записи дошли до регистров
+        invalidateShadow();
+        throw;
+    }
+}
+
+ContrEM1::ShadowCounters ContrEM1::shadowCounters() const {
+    return {mReadsAvoided, mWritesAvoided, mStatusPolls};
+}
+
+void ContrEM1::resetBusCounters() {
+    mQbusDev.resetCounters();
+    mReadsAvoided = 0;
+    mWritesAvoided = 0;
+    mStatusPolls = 0;
+}
+
+bool ContrEM1::updateShadow(long addr, uint16_t data) {
+    auto& shadow = mShadow.at(addr);
+    if(shadow.valid && shadow.value == data) {
+        ++mWritesAvoided;
+        return false;
+    }
+    shadow = {data, true};
+    return true;
+}
+
+void ContrEM1::writeShadowed(long addr, uint16_t data) {
+    if(!updateShadow(addr, data))
+        return;
+    try {
+        writeWord(addr, data);
+    } catch(...) {
+        mShadow.at(addr).valid = false;
+        throw;
+    }
+}
+
+uint16_t ContrEM1::readShadowed(long addr) {
+    auto& shadow = mShadow.at(addr);
+    if(shadow.valid) {
+        ++mReadsAvoided;
+        return shadow.value;
+    }
+    shadow = {readWord(addr), true};
+    return shadow.value;
+}
+
+void ContrEM1::invalidateShadow() {
+    for(auto& shadow : mShadow)
+        shadow.valid = false;
+}
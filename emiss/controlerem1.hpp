@@ -7,7 +7,11 @@
 
 #include "pciqbus.hpp"
 
+#include <array>
+#include <atomic>
+#include <initializer_list>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 class ContrEM1 {
@@ -15,6 +19,14 @@ public:
     enum class TypeSignal : uint16_t {
         pulse = 0, potential = 1,
    };
+    // Адрес операции задается относительно базового адреса контроллера
+    using Operation = PciQbus::Operation;
+    // Обращения к QBus, замененные теневыми копиями, и опросы статуса ПЧ
+    struct ShadowCounters {
+        uintmax_t readsAvoided;
+        uintmax_t writesAvoided;
+        uintmax_t statusPolls;
+    };
 public:
     ContrEM1(long baseAddress);
     
@@ -65,6 +77,15 @@ public:
     void resetSignal(uint16_t nmOut);
     // генерация сигнала, заданного типа
     void generateSignal(TypeSignal sType, uint16_t nmOut );  
+    // генерация нескольких сигналов одним пакетом операций
+    void generateSignals(std::initializer_list<std::pair<TypeSignal, uint16_t>> signals);
+
+    // пакет операций с регистрами контроллера
+    void execute(std::vector<Operation>& operations);
+    // системные вызовы и операции с регистрами QBus
+    PciQbus::Counters busCounters() const { return mQbusDev.counters(); }
+    ShadowCounters shadowCounters() const;
+    void resetBusCounters();
 protected:
     void setTypeSignal(uint16_t codeOutSignal);
     void generateSignal(uint16_t nmOut);
@@ -93,10 +114,33 @@ protected:
     void writeData(uint16_t data);
     // чтение регистра данных
     uint16_t readData();                
+
+    /*
+     * Теневые копии регистров, повторная запись того же значения в которые
+     * ничего не меняет: прерывания, управления и типа сигнала.
+     * Копии сбрасываются при открытии, сбросе магистрали и общем сбросе.
+     */
+    // true, если значение отличается от копии и запись нужна
+    bool updateShadow(long addr, uint16_t data);
+    void writeShadowed(long addr, uint16_t data);
+    uint16_t readShadowed(long addr);
+    void invalidateShadow();
+    // ожидание бита готовности ПЧ с нарастающей паузой между опросами
+    uint16_t waitStatusPch();
 private:
+    struct Shadow {
+        uint16_t value;
+        bool     valid;
+    };
+
     long mBaseAddress;// базовый адрес А0
     uint8_t mControlReg;
     PciQbus mQbusDev;
+    std::vector<Operation> mBatch;
+    std::array<Shadow, 020> mShadow;
+    std::atomic<uintmax_t> mReadsAvoided;
+    std::atomic<uintmax_t> mWritesAvoided;
+    std::atomic<uintmax_t> mStatusPolls;
 };
 
 /*
@@ -3,13 +3,22 @@
 #include <stdexcept>
 #include <iostream>
 #include <limits>
+#include <new>
+
+#include <sys/time.h>
 
 using std::runtime_error;
 using std::logic_error;
 
+static constexpr unsigned drainTimeout = 100; /* ms */
+
 ContrEM8::ContrEM8(const Conf& conf)
     : mHandle(nullptr),
-      mConf(conf) { }
+      mConf(conf),
+      mHeld(0),
+      mStreamActive(false),
+      mStreamFailed(false),
+      mInFlight(0) { }
 
 ContrEM8::~ContrEM8() {
     if(mHandle != nullptr)
@@ -40,6 +49,7 @@ void ContrEM8::open(uint16_t vid, uint16_t pid) {
 void ContrEM8::close() {
     if(mHandle == nullptr)
         throw logic_error("ContrEM8::close device is closed");
+    stopStream();
     auto status = libusb_release_interface(mHandle, mConf.interface);
     if(status != 0)
         std::cerr << "libusb_release_interface " << libusb_strerror(libusb_error(status)) << std::endl;
@@ -56,11 +66,19 @@ bool ContrEM8::isOpen() const {
     return mHandle != nullptr;
 }
 
-size_t ContrEM8::readData(std::vector<uint32_t>& buffer) {
-	size_t length = buffer.size()*sizeof(uint32_t);
-	if(length == 0 || length > size_t(std::numeric_limits<int>::max()))
+size_t ContrEM8::readData(uint32_t* data, size_t size) {
+	return bulkRead(data, size, mConf.timeout, false);
+}
+
+size_t ContrEM8::drainData(uint32_t* data, size_t size) {
+	return bulkRead(data, size, drainTimeout, true);
+}
+
+size_t ContrEM8::bulkRead(uint32_t* data, size_t size, unsigned timeout, bool allowTimeout) {
+	size_t length = size*sizeof(uint32_t);
+	if(data == nullptr || length == 0 || length > size_t(std::numeric_limits<int>::max()))
 		throw runtime_error("ContrEM8::readData invalid buffer size");
-	auto ptr = reinterpret_cast<unsigned char*>(buffer.data());
+	auto ptr = reinterpret_cast<unsigned char*>(data);
 	int transfered = 0;
 	int status = libusb_bulk_transfer(
 		mHandle,
@@ -68,10 +86,163 @@ size_t ContrEM8::readData(std::vector<uint32_t>& buffer) {
 		ptr,
 		int(length),
 		&transfered,
-		mConf.timeout);
-	if(status != 0)
+		timeout);
+	if(status != 0 && !(allowTimeout && status == LIBUSB_ERROR_TIMEOUT))
 		throw runtime_error(libusb_strerror(libusb_error(status)));
 	if(transfered % sizeof(uint32_t) != 0)
 		throw runtime_error("ContrEM8::readData invalid transfer size");
 	return size_t( transfered/sizeof(uint32_t) );
 }
+
+ContrEM8::Chunk::Chunk(ContrEM8* o, size_t capacity)
+    : owner(o),
+      transfer(libusb_alloc_transfer(0)),
+      buffer(capacity) {
+    if(transfer == nullptr)
+        throw std::bad_alloc();
+}
+
+ContrEM8::Chunk::~Chunk() {
+    libusb_free_transfer(transfer);
+}
+
+void ContrEM8::startStream(size_t transferSize, size_t transferCount) {
+    Lock lk(mStreamMutex);
+    if(mHandle == nullptr)
+        throw logic_error("ContrEM8::startStream device is closed");
+    if(mStreamActive || mEventThread.joinable())
+        throw logic_error("ContrEM8::startStream stream is active");
+    if(transferSize == 0 || transferSize*sizeof(uint32_t) > size_t(std::numeric_limits<int>::max()) || transferCount == 0)
+        throw logic_error("ContrEM8::startStream invalid transfer configuration");
+    mChunks.clear();
+    for(size_t i = 0; i < transferCount; ++i)
+        mChunks.push_back(std::make_unique<Chunk>(this, transferSize));
+    mCompleted.reopen();
+    mHeld = 0;
+    mStreamFailed = false;
+    mStreamActive = true;
+    try {
+        for(auto& chunk : mChunks)
+            submit(chunk.get());
+    } catch(...) {
+        stopLocked(lk);
+        throw;
+    }
+    mEventThread = std::thread(&ContrEM8::eventLoop, this);
+}
+
+void ContrEM8::stopStream() {
+    Lock lk(mStreamMutex);
+    stopLocked(lk);
+}
+
+/*
+ * Передачи освобождаются только после возврата читателем и завершения
+ * всех передач в полете, очередь завершенных очищается до освобождения.
+ */
+void ContrEM8::stopLocked(Lock& lk) {
+    if(!mStreamActive && !mEventThread.joinable() && mChunks.empty())
+        return;
+    mStreamActive = false;
+    mReleased.wait(lk, [this] { return mHeld == 0; });
+    for(auto& chunk : mChunks)
+        libusb_cancel_transfer(chunk->transfer);
+    if(mEventThread.joinable())
+        mEventThread.join();
+    //Поток событий завершился по ошибке или не запускался: отмененные передачи дожидаемся здесь
+    if(mInFlight > 0)
+        eventLoop();
+    if(mInFlight > 0)
+        std::cerr << "ContrEM8::stopStream " << mInFlight << " transfers are not completed" << std::endl;
+    mCompleted.close();
+    mCompleted.clear();
+    mChunks.clear();
+}
+
+bool ContrEM8::isStreaming() const {
+    return mStreamActive;
+}
+
+bool ContrEM8::popChunk(Chunk*& chunk, std::chrono::milliseconds timeout) {
+    if(mStreamFailed)
+        throw runtime_error("ContrEM8::popChunk transfer failed");
+    if(timeout.count() > 0)
+        mCompleted.wait(timeout);
+    Lock lk(mStreamMutex);
+    if(!mCompleted.tryPop(chunk))
+        return false;
+    ++mHeld;
+    return true;
+}
+
+void ContrEM8::releaseChunk(Chunk* chunk) {
+    Lock lk(mStreamMutex);
+    --mHeld;
+    mReleased.notify_all();
+    if(mStreamActive && !mStreamFailed)
+        submit(chunk);
+}
+
+void ContrEM8::submit(Chunk* chunk) {
+    libusb_fill_bulk_transfer(chunk->transfer,
+                              mHandle,
+                              mConf.endpoint,
+                              reinterpret_cast<unsigned char*>(chunk->buffer.data()),
+                              int(chunk->buffer.capacity()*sizeof(uint32_t)),
+                              &ContrEM8::onTransfer,
+                              chunk,
+                              mConf.timeout);
+    ++mInFlight;
+    auto status = libusb_submit_transfer(chunk->transfer);
+    if(status != 0) {
+        --mInFlight;
+        throw runtime_error(libusb_strerror(libusb_error(status)));
+    }
+}
+
+/*
+ * Поток событий libusb работает, пока есть передачи в полете.
+ * Обратные вызовы выполняются в этом потоке. При ошибке поток
+ * завершается, а читатель получает исключение из popChunk().
+ */
+void ContrEM8::eventLoop() {
+    timeval tv{0, 100000};
+    while(mStreamActive || mInFlight > 0) {
+        auto status = libusb_handle_events_timeout_completed(nullptr, &tv, nullptr);
+        if(status != 0 && status != LIBUSB_ERROR_INTERRUPTED) {
+            std::cerr << "ContrEM8::eventLoop " << libusb_strerror(libusb_error(status)) << std::endl;
+            mStreamFailed = true;
+            break;
+        }
+    }
+}
+
+void LIBUSB_CALL ContrEM8::onTransfer(libusb_transfer* transfer) {
+    auto chunk = static_cast<Chunk*>(transfer->user_data);
+    auto self = chunk->owner;
+    --self->mInFlight;
+    switch(transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        if(!self->mStreamActive)
+            return;
+        chunk->buffer.setSize(size_t(transfer->actual_length) / sizeof(uint32_t));
+        if(chunk->buffer.size() == 0) {
+            try {
+                self->submit(chunk);
+            } catch(std::exception& e) {
+                std::cerr << "ContrEM8::onTransfer " << e.what() << std::endl;
+                self->mStreamFailed = true;
+            }
+            return;
+        }
+        self->mCompleted.push(chunk);
+        return;
+    case LIBUSB_TRANSFER_CANCELLED:
+        return;
+    default:
+        std::cerr << "ContrEM8::onTransfer transfer status " << int(transfer->status) << std::endl;
+        self->mStreamFailed = true;
+        return;
+    }
+}
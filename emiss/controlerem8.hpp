@@ -1,24 +1,74 @@
 #pragma once
 
+#include "transferbuffer.hpp"
+#include "tdc/blockingqueue.hpp"
+
 #include <libusb.h>
 
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <vector>
 
 class ContrEM8 {
+    using Mutex = std::mutex;
+    using Lock = std::unique_lock<Mutex>;
 public:
     struct Conf {
         unsigned char endpoint;
         unsigned int timeout;
         int interface;
     };
+    // Передача потокового режима, после обработки возвращается через releaseChunk
+    struct Chunk {
+        Chunk(ContrEM8* o, size_t capacity);
+        ~Chunk();
+        ContrEM8*        owner;
+        libusb_transfer* transfer;
+        TransferBuffer   buffer;
+    };
 public:
     ContrEM8(const Conf& conf);
     void open(uint16_t vid, uint16_t pid);
     void close();
     bool isOpen() const;
     ~ContrEM8();
-    size_t readData(std::vector<uint32_t>& buffer);
+    // Возвращает число принятых слов, не больше size
+    size_t readData(uint32_t* data, size_t size);
+    // Дочитывание: короткий таймаут, таймаут означает, что данных больше нет
+    size_t drainData(uint32_t* data, size_t size);
+
+    // Асинхронное чтение: transferCount передач по transferSize слов в полете
+    void startStream(size_t transferSize = 256*1024, size_t transferCount = 8);
+    // Дожидается возврата удерживаемых передач, может вызываться из другого потока
+    void stopStream();
+    bool isStreaming() const;
+    // После ошибки передачи или потока событий бросает исключение до перезапуска потока
+    bool popChunk(Chunk*& chunk, std::chrono::milliseconds timeout);
+    void releaseChunk(Chunk* chunk);
+protected:
+    size_t bulkRead(uint32_t* data, size_t size, unsigned timeout, bool allowTimeout);
+    void stopLocked(Lock& lk);
+    void submit(Chunk* chunk);
+    void eventLoop();
+    static void LIBUSB_CALL onTransfer(libusb_transfer* transfer);
 private:
     libusb_device_handle* mHandle;
     Conf mConf;
+
+    std::vector<std::unique_ptr<Chunk>> mChunks;
+    BlockingQueue<Chunk*> mCompleted;
+    // Управление потоком и возврат передач; mHeld - передачи у читателя
+    Mutex mStreamMutex;
+    std::condition_variable mReleased;
+    size_t mHeld;
+    std::thread mEventThread;
+    std::atomic_bool mStreamActive;
+    std::atomic_bool mStreamFailed;
+    std::atomic<size_t> mInFlight;
 };
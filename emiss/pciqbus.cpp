@@ -16,11 +16,12 @@ using std::strerror;
 using std::runtime_error;
 
 PciQbus::PciQbus()
-    : mNode(-1), mCurrentAddr(-1) { }
+    : mNode(-1), mSyscalls(0), mOperations(0) { }
 
 PciQbus::PciQbus(const std::string& deviceName)
     : mNode(-1),
-      mCurrentAddr(-1) { this->open(deviceName); }
+      mSyscalls(0),
+      mOperations(0) { this->open(deviceName); }
 
 PciQbus::~PciQbus() { this->close(); }
 
@@ -52,45 +53,65 @@ void PciQbus::resetBranch() {
 }
 
 size_t PciQbus::read(long addr, vector<uint16_t>& buffer) {
-    this->seek(addr);
-    ssize_t count = ::read(mNode, buffer.data(), buffer.size()*sizeof(uint16_t));
-    if(count == -1)
-        error("read", "failed");
-    return count;
+    return transfer("read", Operation::read, addr, buffer.data(), buffer.size());
 }
 
 size_t PciQbus::write(long addr, const vector<uint16_t>& buffer) {
-    this->seek(addr);
-    ssize_t count = ::write(mNode, buffer.data(), buffer.size()*sizeof(uint16_t));
-    if(count == -1)
-        error("write", "failed");
-    return count;
+    return transfer("write", Operation::write, addr, const_cast<uint16_t*>(buffer.data()), buffer.size());
 }
 
 uint16_t PciQbus::readWord(long addr) {
-    static uint16_t word;
-    this->seek(addr);
-    auto size = ::read(mNode, &word, sizeof(word));
-    //if(::read(mNode, &word, sizeof(word)) != sizeof(word))
-    if(size != sizeof(word))
+    uint16_t word;
+    if(transfer("readWord", Operation::read, addr, &word, 1) != sizeof(word))
         error("readWord", "failed");
     return word;
 }
 
 void PciQbus::writeWord(long addr, uint16_t word) {
-    this->seek(addr);
-    if( ::write(mNode, &word, sizeof(word)) != sizeof(word))
+    if(transfer("writeWord", Operation::write, addr, &word, 1) != sizeof(word))
         error("writeWord", "failed");
 }
 
-void PciQbus::seek(long addr) {
-    if(addr != mCurrentAddr) {
-        if(::lseek(mNode, addr, SEEK_SET) == -1)
-            error("seek", strerror(errno));
-        mCurrentAddr = addr;
+void PciQbus::execute(vector<Operation>& operations, long base) {
+    for(size_t i = 0; i < operations.size();) {
+        auto& first = operations[i];
+        auto j = i + 1;
+        while(j < operations.size() && operations[j].type == first.type && operations[j].addr == first.addr)
+            ++j;
+        mScratch.resize(j - i);
+        for(size_t k = i; k < j; ++k)
+            mScratch[k - i] = operations[k].word;
+        auto bytes = mScratch.size()*sizeof(uint16_t);
+        if(transfer("execute", first.type, base + first.addr, mScratch.data(), mScratch.size()) != bytes)
+            error("execute", "failed");
+        if(first.type == Operation::read)
+            for(size_t k = i; k < j; ++k)
+                operations[k].word = mScratch[k - i];
+        i = j;
     }
 }
 
+PciQbus::Counters PciQbus::counters() const {
+    return {mSyscalls, mOperations};
+}
+
+void PciQbus::resetCounters() {
+    mSyscalls = 0;
+    mOperations = 0;
+}
+
+//Смещение в файле устройства - адрес регистра, pread/pwrite не требуют lseek
+size_t PciQbus::transfer(const char* operation, Operation::Type type, long addr, uint16_t* data, size_t count) {
+    auto bytes = count*sizeof(uint16_t);
+    auto n = type == Operation::read ? ::pread(mNode, data, bytes, addr)
+                                     : ::pwrite(mNode, data, bytes, addr);
+    ++mSyscalls;
+    if(n == -1)
+        error(operation, strerror(errno));
+    mOperations += size_t(n) / sizeof(uint16_t);
+    return size_t(n);
+}
+
 void PciQbus::error(const std::string& operation, const char* err) {
     throw runtime_error(StringBuilder() << "QBus::" << operation << ": " << err);
 }
@@ -2,10 +2,23 @@
 
 #include <stdexcept>
 #include <cstdint>
+#include <atomic>
 #include <vector>
 
 class PciQbus {
     using RunTimeError = std::runtime_error;
+public:
+    // Операция с регистром; для чтения результат записывается в word
+    struct Operation {
+        enum Type : uint8_t { read, write };
+        Type     type;
+        long     addr;
+        uint16_t word;
+    };
+    struct Counters {
+        uintmax_t syscalls;
+        uintmax_t operations;
+    };
 public:
     PciQbus();
     PciQbus(const std::string &deviceName);
@@ -24,11 +37,23 @@ public:
 
     uint16_t readWord(long addr);
     void writeWord(long addr, uint16_t word);
+
+    /*
+     * Подряд идущие операции одного типа с одним адресом выполняются
+     * одним блочным pread/pwrite, как read()/write(), остальные -
+     * по одному системному вызову без lseek. Адреса задаются от base.
+     */
+    void execute(std::vector<Operation>& operations, long base = 0);
+
+    Counters counters() const;
+    void resetCounters();
 protected:
-    void seek(long addr);
+    size_t transfer(const char* operation, Operation::Type type, long addr, uint16_t* data, size_t count);
     void error(const std::string& operation, const char* err);
 private:
     int mNode;
-    long mCurrentAddr;
+    std::vector<uint16_t> mScratch;
+    std::atomic<uintmax_t> mSyscalls;
+    std::atomic<uintmax_t> mOperations;
 };
 
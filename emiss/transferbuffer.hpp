@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+#include <unistd.h>
+
+/*
+ * Буфер для передачи по USB: память выровнена по странице и не
+ * инициализируется, емкость выделяется один раз, а число принятых
+ * слов задается отдельно через setSize().
+ */
+class TransferBuffer {
+    struct Free {
+        void operator()(uint32_t* p) const { std::free(p); }
+    };
+public:
+    explicit TransferBuffer(size_t capacity)
+        : mSize(0),
+          mCapacity(0) {
+        reserve(capacity);
+    }
+
+    // Содержимое при перевыделении не сохраняется
+    void reserve(size_t capacity) {
+        if(capacity <= mCapacity)
+            return;
+        void* p = nullptr;
+        auto page = size_t(sysconf(_SC_PAGESIZE));
+        if(posix_memalign(&p, page, capacity*sizeof(uint32_t)) != 0)
+            throw std::bad_alloc();
+        mData.reset(static_cast<uint32_t*>(p));
+        mCapacity = capacity;
+        mSize = 0;
+    }
+
+    void setSize(size_t size) {
+        if(size > mCapacity)
+            throw std::out_of_range("TransferBuffer::setSize size exceeds capacity");
+        mSize = size;
+    }
+
+    uint32_t* data() { return mData.get(); }
+    const uint32_t* data() const { return mData.get(); }
+    size_t size() const { return mSize; }
+    size_t capacity() const { return mCapacity; }
+
+    uint32_t operator[](size_t i) const { return mData[i]; }
+    uint32_t at(size_t i) const {
+        if(i >= mSize)
+            throw std::out_of_range("TransferBuffer::at");
+        return mData[i];
+    }
+private:
+    std::unique_ptr<uint32_t[], Free> mData;
+    size_t mSize;
+    size_t mCapacity;
+};
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <array>
 
 struct ChannelCongruence {
     ChannelCongruence(unsigned c, unsigned w)
@@ -16,3 +21,38 @@ using TrekFreq = std::unordered_map<unsigned, ChamberFreq>;
 
 using ChamberHitCount = std::array<uintmax_t, 4>;
 using TrekHitCount = std::unordered_map<unsigned, ChamberHitCount>;
+
+/*
+ * Плотная таблица канал -> (камера, проволока), строится из ChannelConfig
+ * при запуске набора. Каналы без записи и с номером проволоки вне
+ * ChamberHitCount помечаются значением unmapped.
+ */
+class ChannelTable {
+public:
+    static constexpr unsigned unmapped = std::numeric_limits<unsigned>::max();
+public:
+    explicit ChannelTable(const ChannelConfig& config) {
+        unsigned size = 0;
+        for(auto& c : config)
+            size = std::max(size, c.first + 1);
+        mTable.assign(size, {unmapped, unmapped});
+        for(auto& c : config) {
+            if(c.second.wire < std::tuple_size<ChamberHitCount>::value) {
+                mTable[c.first] = c.second;
+                mChambers = std::max(mChambers, c.second.chamber + 1);
+            }
+        }
+    }
+
+    // nullptr для несопоставленного канала
+    const ChannelCongruence* find(unsigned channel) const {
+        if(channel >= mTable.size() || mTable[channel].chamber == unmapped)
+            return nullptr;
+        return &mTable[channel];
+    }
+    // Номера камер меньше chambers()
+    unsigned chambers() const { return mChambers; }
+private:
+    std::vector<ChannelCongruence> mTable;
+    unsigned mChambers = 0;
+};
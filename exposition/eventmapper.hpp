@@ -0,0 +1,48 @@
+#pragma once
+
+#include "channelconfig.hpp"
+#include "runcounters.hpp"
+
+#include "tdc/tdc.hpp"
+
+#include <trek/data/eventrecord.hpp>
+
+#include <stdexcept>
+
+inline trek::data::HitRecord::Type convertEdgeDetection(Tdc::EdgeDetection ed) {
+    switch(ed) {
+    case Tdc::EdgeDetection::leading:
+        return trek::data::HitRecord::Type::leading;
+    case Tdc::EdgeDetection::trailing:
+        return trek::data::HitRecord::Type::trailing;
+    default:
+        throw std::logic_error("EventWriter::convertEdgeDetection invalid value");
+    }
+}
+
+/*
+ * Один проход по хитам события: таблица каналов, запись HitRecord и счет
+ * камер. Каналы вне channels.conf пропускаются и учитываются в счете unmapped.
+ */
+inline void mapEvent(const ChannelTable& channels,
+                     const EventBatch& batch,
+                     size_t event,
+                     RunCounters::Batch& counts,
+                     trek::data::EventHits& hits) {
+    auto begin = batch.eventBegin(event);
+    auto end = batch.eventEnd(event);
+    hits.clear();
+    hits.reserve(end - begin);
+    uintmax_t unmapped = 0;
+    for(auto h = begin; h < end; ++h) {
+        auto c = channels.find(batch.channel(h));
+        if(c == nullptr) {
+            ++unmapped;
+            continue;
+        }
+        hits.emplace_back(convertEdgeDetection(Tdc::EdgeDetection(batch.edge(h))), c->wire, c->chamber, batch.time(h));
+        counts.addHit(c->chamber, c->wire);
+    }
+    counts.addTriggers(1);
+    counts.addUnmapped(unmapped);
+}
@@ -3,10 +3,13 @@
 #include <trek/common/stringbuilder.hpp>
 #include <trek/common/serialization.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
 
 using trek::data::EventRecord;
+using trek::data::EventHits;
 using trek::StringBuilder;
 
 using std::vector;
@@ -18,28 +21,119 @@ using std::runtime_error;
 using std::exception;
 using std::logic_error;
 
+//Поля .tdt до специальных слов: номер события, триггер, время, заголовок, число слов, признаки
+static constexpr size_t stampSize = 2*sizeof(uint32_t) + sizeof(int64_t) + sizeof(EventHeader::words) + 2*sizeof(uint32_t);
+
+template<typename T>
+static char* put(char* pos, const T& value) {
+    std::memcpy(pos, &value, sizeof(value));
+    return pos + sizeof(value);
+}
+
 EventWriter::EventWriter(const string& path,
                          const string& prefix,
                          unsigned eventsPerFile)
-    : mFileCount(0),
+    : mBatchStream(&mBatch),
+      mStampBatchStream(&mStampBatch),
+      mFileCount(0),
       mEventCount(0),
+      mLostEvents(0),
+      mLostStamps(0),
       mPath(path),
       mPrefix(prefix),
       mEventsPerFile(eventsPerFile) {
     mStream.exceptions(mStream.failbit | mStream.badbit);
+    mStampStream.exceptions(mStampStream.failbit | mStampStream.badbit);
 }
 
-void EventWriter::writeEvent(const EventRecord& record) {
+/*
+ * Событие считается записанным, как только записан .tds: номера событий
+ * и смена файлов идут по .tds. Ошибка записи .tdt учитывается отдельно.
+ */
+void EventWriter::writeEvent(const EventRecord& record, const EventBatch& batch, size_t event) {
     try {
         if(mEventCount % mEventsPerFile == 0)
             openStream();
         trek::serialize(mStream, record);
         ++mEventCount;
     } catch(const exception& e) {
-        std::cerr << "EventWriter::writeEvent " << e.what() << std::endl;
+        ++mLostEvents;
+        std::cerr << "EventWriter::writeEvent lost event " << record.eventNumber() << ": " << e.what() << std::endl;
+        return;
+    }
+    try {
+        serializeStamp(mStampStream, uint32_t(record.eventNumber()), batch, event);
+    } catch(const exception& e) {
+        ++mLostStamps;
+        std::cerr << "EventWriter::writeEvent lost .tdt of event " << record.eventNumber() << ": " << e.what() << std::endl;
     }
 }
 
+void EventWriter::writeEvents(unsigned nRun, const EventBatch& batch, vector<EventHits>& events) {
+    //Начало части пакета, которая еще не записана целиком
+    size_t written = 0;
+    try {
+        size_t i = 0;
+        while(i < batch.eventCount()) {
+            if(mEventCount % mEventsPerFile == 0)
+                openStream();
+            //Часть пакета до конца текущего файла
+            auto n = std::min<size_t>(batch.eventCount() - i, mEventsPerFile - mEventCount % mEventsPerFile);
+            mBatch.clear();
+            mStampBatch.clear();
+            //Номер события - порядковый в наборе, номер триггера только в .tdt
+            auto nEvent = mEventCount;
+            for(auto end = i + n; i < end; ++i, ++nEvent)
+                serializeEvent(mBatchStream, mStampBatchStream, {nRun, nEvent, std::move(events.at(i))}, batch, i);
+            mStream.write(mBatch.data(), mBatch.size());
+            mEventCount += unsigned(n);
+            written = i;
+            writeStamps(n);
+        }
+    } catch(const exception& e) {
+        auto lost = batch.eventCount() - written;
+        mLostEvents += lost;
+        std::cerr << "EventWriter::writeEvents lost " << lost << " of " << batch.eventCount()
+                  << " events: " << e.what() << std::endl;
+    }
+}
+
+void EventWriter::writeStamps(size_t count) {
+    try {
+        mStampStream.write(mStampBatch.data(), mStampBatch.size());
+    } catch(const exception& e) {
+        mLostStamps += count;
+        std::cerr << "EventWriter::writeEvents lost .tdt of " << count << " events: " << e.what() << std::endl;
+    }
+}
+
+void EventWriter::serializeEvent(std::ostream& stream, std::ostream& stampStream,
+                                 const EventRecord& record,
+                                 const EventBatch& batch, size_t event) {
+    trek::serialize(stream, record);
+    serializeStamp(stampStream, uint32_t(record.eventNumber()), batch, event);
+}
+
+/*
+ * Запись .tdt: номер события, номер триггера, время чтения, слова
+ * заголовка, число специальных слов, признаки и сами специальные слова.
+ * Поля собираются в массив, запись и специальные слова пишутся двумя вызовами.
+ */
+void EventWriter::serializeStamp(std::ostream& stream, uint32_t nEvent, const EventBatch& batch, size_t event) {
+    auto& header = batch.header(event);
+    auto specials = uint32_t(batch.specialEnd(event) - batch.specialBegin(event));
+    char stamp[stampSize];
+    auto pos = put(stamp, nEvent);
+    pos = put(pos, batch.trigger(event));
+    pos = put(pos, batch.timestamp(event));
+    pos = put(pos, header.words);
+    pos = put(pos, specials);
+    put(pos, header.flags);
+    stream.write(stamp, sizeof(stamp));
+    if(specials != 0)
+        stream.write(reinterpret_cast<const char*>(batch.specials() + batch.specialBegin(event)), specials*sizeof(uint32_t));
+}
+
 void EventWriter::writeDrop(const EventRecord &record) {
     try {
         if(!mDropStream.is_open()) {
@@ -55,14 +149,23 @@ void EventWriter::writeDrop(const EventRecord &record) {
 void EventWriter::openStream() {
     if(mStream.is_open()) {
         mStream.close();
+        //Ошибка .tdt не должна останавливать смену файлов .tds
+        mStampStream.exceptions(mStampStream.goodbit);
+        mStampStream.close();
+        if(!mStampStream)
+            std::cerr << "EventWriter::openStream failed to close .tdt of file " << mFileCount << std::endl;
+        mStampStream.clear();
+        mStampStream.exceptions(mStampStream.failbit | mStampStream.badbit);
         ++mFileCount;
     }
-    mStream.open(formFileName(), mStream.binary | mStream.trunc);
+    mStream.open(formFileName(".tds"), mStream.binary | mStream.trunc);
     mStream << "TDSa\n";
+    mStampStream.open(formFileName(".tdt"), mStampStream.binary | mStampStream.trunc);
+    mStampStream << "TDTc\n";
 }
 
-string EventWriter::formFileName() const {
+string EventWriter::formFileName(const char* extension) const {
     return StringBuilder() << mPath << '/' << mPrefix
                            << setw(9) << setfill('0') << mFileCount
-                           << ".tds";
+                           << extension;
 }
@@ -1,7 +1,10 @@
 #pragma once
 
+#include "tdc/eventbatch.hpp"
+
 #include <trek/data/eventrecord.hpp>
 #include <fstream>
+#include <vector>
 
 
 class EventWriter {
@@ -9,17 +12,65 @@ public:
     EventWriter(const std::string& path,
                 const std::string& prefix,
                 unsigned eventsPerFile);
-    void writeEvent(const trek::data::EventRecord& record);
+    /*
+     * Номер триггера, время чтения, заголовок и специальные слова события
+     * event из batch записываются в файл .tdt рядом с .tds
+     */
+    void writeEvent(const trek::data::EventRecord& record, const EventBatch& batch, size_t event);
+    /*
+     * Пакет событий сериализуется в память и записывается одним вызовом на
+     * файл, байты совпадают с writeEvent(). События нумеруются подряд от
+     * начала набора: номер триггера модуля переполняется и не уникален.
+     * Хиты events перемещаются в записи, после вызова векторы пусты.
+     */
+    void writeEvents(unsigned nRun, const EventBatch& batch, std::vector<trek::data::EventHits>& events);
     void writeDrop(const trek::data::EventRecord& record);
+
+    // События, не записанные из-за ошибок записи
+    uintmax_t lostEvents() const { return mLostEvents; }
+    // События, записанные в .tds, но без записи в .tdt
+    uintmax_t lostStamps() const { return mLostStamps; }
 protected:
+    // Буфер сериализации пакета, память сохраняется между пакетами
+    class Buffer : public std::streambuf {
+    public:
+        const char* data() const { return mData.data(); }
+        std::streamsize size() const { return std::streamsize(mData.size()); }
+        void clear() { mData.clear(); }
+    protected:
+        int_type overflow(int_type c) override {
+            if(!traits_type::eq_int_type(c, traits_type::eof()))
+                mData.push_back(traits_type::to_char_type(c));
+            return traits_type::not_eof(c);
+        }
+        std::streamsize xsputn(const char* s, std::streamsize n) override {
+            mData.insert(mData.end(), s, s + n);
+            return n;
+        }
+    private:
+        std::vector<char> mData;
+    };
+
+    static void serializeEvent(std::ostream& stream, std::ostream& stampStream,
+                               const trek::data::EventRecord& record,
+                               const EventBatch& batch, size_t event);
+    static void serializeStamp(std::ostream& stream, uint32_t nEvent, const EventBatch& batch, size_t event);
+    void writeStamps(size_t count);
     void reopenStream();
     void openStream();
-    std::string formFileName() const;
+    std::string formFileName(const char* extension) const;
 private:
     std::ofstream mStream;
+    std::ofstream mStampStream;
     std::ofstream mDropStream;
+    Buffer        mBatch;
+    Buffer        mStampBatch;
+    std::ostream  mBatchStream;
+    std::ostream  mStampBatchStream;
     unsigned      mFileCount;
     unsigned      mEventCount;
+    uintmax_t     mLostEvents;
+    uintmax_t     mLostStamps;
 
     const std::string   mPath;
     const std::string   mPrefix;
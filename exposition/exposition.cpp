@@ -1,6 +1,7 @@
 #include "exposition.hpp"
 #include "freq.hpp"
 #include "eventwriter.hpp"
+#include "eventmapper.hpp"
 
 #include "net/packagereceiver.hpp"
 
@@ -37,6 +38,15 @@ using nlohmann::json;
 
 namespace fs = boost::filesystem;
 
+//Пакетов в очереди между этапами; пакет - одно чтение модуля
+static constexpr size_t queueCapacity = 16;
+//Пауза этапа при пустой очереди на входе или заполненной на выходе
+static constexpr microseconds idleDelay(200);
+
+static void idle() {
+    std::this_thread::sleep_for(idleDelay);
+}
+
 struct EventID {
     EventID(unsigned r, unsigned e) : nRun(r), nEvent(e) { }
     unsigned nRun;
@@ -56,22 +66,34 @@ static auto formatPrefix(const Exposition::Settings& settings) {
     return string( StringBuilder() << "ctudc_" << setw(5) << setfill('0') << settings.nRun << '_' );
 }
 
-static auto printStartMeta(const Exposition::Settings& settings, Tdc& module) {
+static auto printStartMeta(const string& dir, const Exposition::Settings& settings, Tdc& module,
+                           const vector<shared_ptr<Tdc>>& metaModules) {
     std::ofstream stream;
     stream.exceptions(stream.failbit | stream.badbit);
-    auto filename = formatDir(settings) + "/meta";
+    auto filename = dir + "/meta";
     stream.open(filename, stream.binary | stream.trunc);
     stream << "Run: " << settings.nRun << '\n';
     stream << "Time: " << system_clock::now() << '\n';
     stream << "TDC: " << module.name() << '\n';
     stream << module.settings();
+    module.printMeta(stream);
+    for(auto& m : metaModules) {
+        if(m.get() == &module)
+            continue;
+        stream << "Module: " << m->name() << '\n';
+        m->printMeta(stream);
+    }
     return filename;
 }
 
-static auto printEndMeta(const string& filename) {
+static auto printEndMeta(const string& filename, const Tdc& module, const Exposition& expo, const EventWriter& writer) {
     std::ofstream stream;
     stream.exceptions(stream.failbit | stream.badbit);
     stream.open(filename, stream.binary | stream.app);
+    module.printStats(stream);
+    expo.printStats(stream);
+    stream << "Lost events:    " << writer.lostEvents() << '\n';
+    stream << "Lost stamps:    " << writer.lostStamps() << '\n';
     stream << "Stopped: " << system_clock::now();
 }
 
@@ -107,103 +129,211 @@ static auto handleCtrlPkg(vector<char>& buffer) {
     return command;
 }
 
-static auto convertEdgeDetection(Tdc::EdgeDetection ed) {
-    switch(ed) {
-    case Tdc::EdgeDetection::leading:
-        return HitRecord::Type::leading;
-    case Tdc::EdgeDetection::trailing:
-        return HitRecord::Type::trailing;
-    default:
-        throw std::logic_error("EventWriter::convertEdgeDetection invalid value");
-    }
-}
-
-static auto convertEvents(const vector<Tdc::EventHits>& events, const ChannelConfig& conf) {
-    vector<EventHits> newEvents;
-    std::transform(events.begin(), events.end(), std::back_inserter(newEvents), [&](auto& eventHits){
-        return convertEventHits(eventHits, conf);
-    });
-    return newEvents;  
-}
-
-static auto convertEventHits(const Tdc::EventHits& hits, const ChannelConfig& conf) {
-    EventHits newHits;
-    std::transform(hits.begin(), hits.end(), std::back_inserter(newHits), [&](auto& hit){
-        return convertHit(hit, conf);
-    });
-    return newHits;      
-}
-
-static auto convertHit(const Tdc::Hit& hit, const ChannelConfig& conf) {
-    auto& c = conf.at(hit.channel);    
-    return HitRecord(convertEdgeDetection(hit.type), c.wire,  c.chamber, hit.time);
-}
 
 Exposition::Exposition(shared_ptr<Tdc> tdc,
                        const Settings& settings,
                        const ChannelConfig& config,
-                       std::function<void(TrekFreq)> onMonitor)
+                       std::function<void(TrekFreq)> onMonitor,
+                       const vector<shared_ptr<Tdc>>& metaModules)
     : mInfoRecv(settings.infoIP, settings.infoPort),
       mCtrlRecv(settings.ctrlIP, settings.ctrlPort),
-      mTrgCount{0, 0},
-      mPkgCount{0, 0},
+      mChannels(config),
+      mDecodeQueue(queueCapacity),
+      mFreeRaw(queueCapacity),
+      mMapQueue(queueCapacity),
+      mFreeBatches(queueCapacity),
+      mWriteQueue(queueCapacity),
+      mFreeMapped(queueCapacity),
+      mNevodCounts(queueCapacity),
+      mReadStalls(0),
+      mDecodeStalls(0),
+      mMapStalls(0),
+      mReadDone(false),
+      mDecodeDone(false),
+      mMapDone(false),
+      mMetaModules(metaModules),
       mActive(true),
       mOnMonitor(onMonitor) {
           if(!tdc->isOpen())
               throw std::logic_error("launchExpo tdc is not open");
+          for(auto& counters : mCounters)
+              counters.reset(mChannels.chambers());
+          mRunDir = formatDir(settings);
+          mMetaFilename = printStartMeta(mRunDir, settings, *tdc, mMetaModules);
           tdc->clear();
-          mReadThread = std::thread(&Exposition::readLoop, this, tdc, std::ref(settings), std::ref(config));
+          mReadThread = std::thread(&Exposition::readStage, this, tdc);
+          mDecodeThread = std::thread(&Exposition::decodeStage, this, tdc);
+          mMapThread = std::thread(&Exposition::mapStage, this);
+          mWriteThread = std::thread(&Exposition::writeStage, this, tdc, std::ref(settings));
       }
 
 Exposition::~Exposition() {
     stop();
     mReadThread.join();
+    mDecodeThread.join();
+    mMapThread.join();
+    mWriteThread.join();
 }
 
-void Exposition::readLoop(shared_ptr<Tdc> tdc, const Settings& settings, const ChannelConfig& config) {
-    auto metaFilename = printStartMeta(settings, *tdc);
-    
-    vector<Tdc::EventHits> buffer;
-    unsigned num = 0;
-    
-    EventWriter eventWriter(formatDir(settings), formatPrefix(settings), settings.eventsPerFile);
-    
-    std::function<void(EventHits&)> writer = [&](EventHits& event) {
-        eventWriter.writeEvent({settings.nRun, num++, event});
-    };
-    
+void Exposition::readStage(shared_ptr<Tdc> tdc) {
+    Tdc::RawData raw;
     while(mActive) {
-        try {            
-            std::this_thread::sleep_for(seconds(1));
-            tdc->readEvents(buffer);
-            std::cout << "triggers: " << buffer.size() << std::endl;           
-            auto events = handleEvents(buffer, config, false);
-            std::for_each(events.begin(), events.end(), writer);
+        //Очередь заполнена: новые данные остаются в буфере модуля, пока
+        //следующие этапы не освободят место
+        if(mDecodeQueue.full()) {
+            ++mReadStalls;
+            idle();
+            continue;
+        }
+        try {
+            tdc->waitEvents(seconds(1));
+            mFreeRaw.tryPop(raw);
+            tdc->readRaw(raw);
+            if(!raw.empty())
+                mDecodeQueue.tryPush(raw);
+        } catch(std::exception& e) {
+            std::cerr << "readStage: " << e.what() << std::endl;
+        }
+    }
+    mReadDone = true;
+}
+
+void Exposition::decodeStage(shared_ptr<Tdc> tdc) {
+    Tdc::RawData raw;
+    EventBatch batch;
+    while(true) {
+        if(!mDecodeQueue.tryPop(raw)) {
+            if(mReadDone && mDecodeQueue.empty())
+                break;
+            idle();
+            continue;
+        }
+        //Слова и пакеты возвращаются по кругу и сохраняют выделенную память
+        mFreeBatches.tryPop(batch);
+        try {
+            tdc->decodeRaw(raw, batch);
         } catch(std::exception& e) {
-            std::cerr << "readLoop: " << e.what() << std::endl;
+            std::cerr << "decodeStage: " << e.what() << std::endl;
+            mFreeRaw.tryPush(raw);
+            continue;
+        }
+        mFreeRaw.tryPush(raw);
+        std::cout << "triggers: " << batch.eventCount() << std::endl;
+        if(batch.empty())
+            continue;
+        while(!mMapQueue.tryPush(batch)) {
+            ++mDecodeStalls;
+            idle();
         }
     }
-    printEndMeta(metaFilename);
+    mDecodeDone = true;
 }
 
-void Exposition::writeLoop(const Settings& settings, const ChannelConfig& config) {
+void Exposition::mapStage() {
+    EventBatch batch;
+    MappedBatch mapped;
+    while(true) {
+        if(!mMapQueue.tryPop(batch)) {
+            if(mDecodeDone && mMapQueue.empty())
+                break;
+            idle();
+            continue;
+        }
+        //Пакеты и буферы событий возвращаются по кругу и сохраняют выделенную память
+        mFreeMapped.tryPop(mapped);
+        std::swap(mapped.batch, batch);
+        mFreeBatches.tryPush(batch);
+        try {
+            mapEvents(mapped);
+        } catch(std::exception& e) {
+            std::cerr << "mapStage: " << e.what() << std::endl;
+            continue;
+        }
+        while(!mWriteQueue.tryPush(mapped)) {
+            ++mMapStalls;
+            idle();
+        }
+    }
+    mMapDone = true;
+}
+
+void Exposition::writeStage(shared_ptr<Tdc> tdc, const Settings& settings) {
+    EventWriter eventWriter(mRunDir, formatPrefix(settings), settings.eventsPerFile);
+    MappedBatch mapped;
+    while(true) {
+        applyNevodCounts();
+        if(!mWriteQueue.tryPop(mapped)) {
+            if(mMapDone && mWriteQueue.empty())
+                break;
+            idle();
+            continue;
+        }
+        //Номер триггера модуля пишется в .tdt, пропуски видны по нему
+        eventWriter.writeEvents(settings.nRun, mapped.batch, mapped.events);
+        mCounters[0].add(mapped.counts);
+        mFreeMapped.tryPush(mapped);
+    }
+    applyNevodCounts();
+    printEndMeta(mMetaFilename, *tdc, *this, eventWriter);
+}
+
+void Exposition::mapEvents(MappedBatch& mapped) {
+    auto& batch = mapped.batch;
+    if(mapped.events.size() < batch.eventCount())
+        mapped.events.resize(batch.eventCount());
+    mapped.counts.reset(mChannels.chambers());
+    for(size_t event = 0; event < batch.eventCount(); ++event) {
+        mapEvent(mChannels, batch, event, mapped.counts, mapped.events[event]);
+    }
+    mapped.counts.addPackages(1);
+}
+
+void Exposition::applyNevodCounts() {
+    RunCounters::Batch counts;
+    while(mNevodCounts.tryPop(counts))
+        mCounters[0].add(counts);
+}
+
+Exposition::QueueStats Exposition::decodeQueueStats() const {
+    return {mDecodeQueue.size(), mDecodeQueue.highWater(), mDecodeQueue.capacity(), mReadStalls};
+}
+
+Exposition::QueueStats Exposition::mapQueueStats() const {
+    return {mMapQueue.size(), mMapQueue.highWater(), mMapQueue.capacity(), mDecodeStalls};
+}
+
+Exposition::QueueStats Exposition::writeQueueStats() const {
+    return {mWriteQueue.size(), mWriteQueue.highWater(), mWriteQueue.capacity(), mMapStalls};
+}
+
+void Exposition::printStats(std::ostream& stream) const {
+    auto print = [&stream](const char* name, const QueueStats& q) {
+        stream << name << q.highWater << " of " << q.capacity << " batches high-water, "
+               << q.stalls << " stalls\n";
+    };
+    print("Decode queue:   ", decodeQueueStats());
+    print("Map queue:      ", mapQueueStats());
+    print("Write queue:    ", writeQueueStats());
+    stream << "Unmapped hits:  " << counters().unmapped << '\n';
+}
+
+void Exposition::writeLoop(const Settings& settings) {
     unique_ptr<EventID> nvdID;
     EventWriter eventWriter(formatDir(settings), formatPrefix(settings), settings.eventsPerFile);
 
-    mInfoRecv.onRecv([this, &eventWriter, &nvdID, &config](vector<char>& nvdMsg) {
+    mInfoRecv.onRecv([this, &eventWriter, &nvdID](vector<char>& nvdMsg) {
         Lock lk(mBufferMutex);
         try {
             auto nvdPkg = handleNvdPkg(nvdMsg);
             if(nvdID) {
-                auto drop = !(nvdID && nvdID->nRun == nvdPkg.numberOfRun && nvdPkg.numberOfRecord - nvdID->nEvent == mBuffer.size());
+                auto drop = !(nvdID && nvdID->nRun == nvdPkg.numberOfRun && nvdPkg.numberOfRecord - nvdID->nEvent == mBuffer.eventCount());
                 auto num = nvdID->nEvent + 1;
-                std::function<void(EventHits&)> writer = [&](EventHits& event) {
-                    eventWriter.writeEvent({nvdID->nRun, num++, event});
+                EventHandler writer = [&](const EventBatch& batch, size_t i, EventHits& event) {
+                    eventWriter.writeEvent({nvdID->nRun, num++, event}, batch, i);
                 };
-                if(drop) writer = [&](EventHits& event) { eventWriter.writeDrop({nvdID->nRun, num++, event}); };
+                if(drop) writer = [&](const EventBatch&, size_t, EventHits& event) { eventWriter.writeDrop({nvdID->nRun, num++, event}); };
 
-                auto events = handleEvents(mBuffer, config, drop);
-                std::for_each(events.begin(), events.end(), writer);
+                handleEvents(mBuffer, drop, writer);
             }
             mBuffer.clear();
             nvdID = make_unique<EventID>(nvdPkg.numberOfRun, nvdPkg.numberOfRecord);
@@ -214,8 +344,8 @@ void Exposition::writeLoop(const Settings& settings, const ChannelConfig& config
     mInfoRecv.start();
 }
 
-void Exposition::monitorLoop(shared_ptr<Tdc> tdc, const ChannelConfig& conf) {
-    mCtrlRecv.onRecv([this, tdc, conf](vector<char>& msg) {
+void Exposition::monitorLoop(shared_ptr<Tdc> tdc) {
+    mCtrlRecv.onRecv([this, tdc](vector<char>& msg) {
         
         try {
             auto command = handleCtrlPkg(msg);
@@ -232,7 +362,7 @@ void Exposition::monitorLoop(shared_ptr<Tdc> tdc, const ChannelConfig& conf) {
                 mCv.wait_for(l, seconds(50));
                 auto freq = stop();
                 tdc->setMode(prevMode);
-                mOnMonitor(convertFreq(freq, conf));
+                mOnMonitor(convertFreq(freq, mChannels));
             }
         } catch(std::exception& e) {
             std::cerr << "Expo monitor loop " << e.what() << std::endl;
@@ -241,28 +371,34 @@ void Exposition::monitorLoop(shared_ptr<Tdc> tdc, const ChannelConfig& conf) {
     mCtrlRecv.start();
 }
 
-vector<EventHits> Exposition::handleEvents(const EventBuffer& buffer, const ChannelConfig& conf, bool drop) {
-    auto events = convertEvents(buffer, conf);
-    auto i = drop ? 1 : 0;
-    mTrgCount[i] += events.size();
-    mPkgCount[i] += 1;
-    for(auto& event : events) {
-        for(auto& hit : event) {
-            if(mChambersCount[i].count(hit.chamber()) == 0)
-                mChambersCount[i].emplace(hit.chamber(), ChamberHitCount{{0, 0, 0, 0}});
-            ++mChambersCount[i].at(hit.chamber()).at(hit.wire());
-        }
+/*
+ * Выполняется в потоке приемника NEVOD. Отброшенные события считает он сам,
+ * счет записанных передается этапу записи - единственному писателю mCounters[0].
+ */
+void Exposition::handleEvents(const EventBatch& batch, bool drop, const EventHandler& handler) {
+    mEventCounts.reset(mChannels.chambers());
+    for(size_t event = 0; event < batch.eventCount(); ++event) {
+        mapEvent(mChannels, batch, event, mEventCounts, mEventHits);
+        handler(batch, event, mEventHits);
+    }
+    mEventCounts.addPackages(1);
+    if(drop) {
+        mCounters[1].add(mEventCounts);
+        return;
     }
-    return events;
+    while(!mNevodCounts.tryPush(mEventCounts))
+        idle();
 }
 
-TrekFreq convertFreq(const ChannelFreq& freq, const ChannelConfig& conf) {
+TrekFreq convertFreq(const ChannelFreq& freq, const ChannelTable& table) {
     TrekFreq newFreq;
     for(auto& chanFreq : freq) {
-        auto& c = conf.at(chanFreq.first);
-        if(newFreq.count(c.chamber) == 0)
-            newFreq.emplace(c.chamber, ChamberFreq{{0, 0, 0, 0}});
-        newFreq.at(c.chamber).at(c.wire) = chanFreq.second;
+        auto c = table.find(chanFreq.first);
+        if(c == nullptr)
+            continue;
+        if(newFreq.count(c->chamber) == 0)
+            newFreq.emplace(c->chamber, ChamberFreq{{0, 0, 0, 0}});
+        newFreq.at(c->chamber).at(c->wire) = chanFreq.second;
     }
     return newFreq;
 }
@@ -5,6 +5,8 @@
 
 #include "channelconfig.hpp"
 #include "freq.hpp"
+#include "spscqueue.hpp"
+#include "runcounters.hpp"
 
 #include <trek/data/eventrecord.hpp>
 #include <json.hpp>
@@ -16,7 +18,7 @@
 class Exposition {
     using Mutex = std::mutex;
     using Lock = std::lock_guard<Mutex>;
-    using EventBuffer = std::vector<Tdc::EventHits>;
+    using EventHandler = std::function<void(const EventBatch&, size_t, trek::data::EventHits&)>;
 public:
     struct Settings {
         unsigned    nRun;
@@ -30,44 +32,96 @@ public:
         nlohmann::json marshal() const;
         void unMarshal(const nlohmann::json& doc);
     };
+    // Заполнение очереди между этапами и число задержек этапа-писателя
+    struct QueueStats {
+        size_t    depth;
+        size_t    highWater;
+        size_t    capacity;
+        uintmax_t stalls;
+    };
 public:
     Exposition(std::shared_ptr<Tdc> tdc,
                const Settings& settings,
                const ChannelConfig& config,
-               std::function<void(TrekFreq)> onMonitor);
+               std::function<void(TrekFreq)> onMonitor,
+               const std::vector<std::shared_ptr<Tdc>>& metaModules = {});
     ~Exposition();
     operator bool() const { return mActive; }
     
     void stop() { mActive = false; }
     
-    uintmax_t triggerCount() const { return mTrgCount[0]; }
-    uintmax_t triggerDrop() const { return mTrgCount[1]; }
-    
-    uintmax_t packageCount() const { return mPkgCount[0]; }
-    uintmax_t packageDrop() const { return mPkgCount[1]; }
-    
-    TrekHitCount chambersCount() const { return mChambersCount[0]; }
-    TrekHitCount chamberDrop() const { return mChambersCount[1]; }
+    // Согласованные снимки счетчиков записанных и отброшенных событий
+    RunCounters::Snapshot counters() const { return mCounters[0].snapshot(); }
+    RunCounters::Snapshot dropCounters() const { return mCounters[1].snapshot(); }
+
+    // Очереди чтение -> декодирование, декодирование -> преобразование
+    // и преобразование -> запись
+    QueueStats decodeQueueStats() const;
+    QueueStats mapQueueStats() const;
+    QueueStats writeQueueStats() const;
+    void printStats(std::ostream& stream) const;
 protected:    
-    void readLoop(std::shared_ptr<Tdc> tdc, const Settings& settings, const ChannelConfig& config);
-    void writeLoop(const Settings& settings, const ChannelConfig& config);
-    void monitorLoop(std::shared_ptr<Tdc> tdc, const ChannelConfig& conf);
+    // Преобразованные события пакета, передаются этапу записи
+    struct MappedBatch {
+        EventBatch batch;
+        std::vector<trek::data::EventHits> events;
+        RunCounters::Batch counts;
+    };
 
-    std::vector<trek::data::EventHits> handleEvents(const EventBuffer& buffer, const ChannelConfig& conf, bool drop);
+    /*
+     * Этапы конвейера, каждый в своем потоке: чтение модуля без декодирования,
+     * декодирование, преобразование каналов со статистикой, запись на диск.
+     * После остановки чтения оставшиеся в очередях данные обрабатываются
+     * и записываются.
+     */
+    void readStage(std::shared_ptr<Tdc> tdc);
+    void decodeStage(std::shared_ptr<Tdc> tdc);
+    void mapStage();
+    void writeStage(std::shared_ptr<Tdc> tdc, const Settings& settings);
+    void mapEvents(MappedBatch& mapped);
+
+    void writeLoop(const Settings& settings);
+    void monitorLoop(std::shared_ptr<Tdc> tdc);
+
+    void handleEvents(const EventBatch& batch, bool drop, const EventHandler& handler);
+    void applyNevodCounts();
 private:
-    EventBuffer mBuffer;
+    EventBatch mBuffer;
+    trek::data::EventHits mEventHits;
+    RunCounters::Batch mEventCounts;
     PackageReceiver mInfoRecv;
     PackageReceiver mCtrlRecv;
+    ChannelTable mChannels;
 
     std::thread mWriteThread;
     std::thread mMonitorThread;
     std::thread mReadThread;
+    std::thread mDecodeThread;
+    std::thread mMapThread;
+
+    SpscQueue<Tdc::RawData> mDecodeQueue;
+    SpscQueue<Tdc::RawData> mFreeRaw;
+    SpscQueue<EventBatch>  mMapQueue;
+    SpscQueue<EventBatch>  mFreeBatches;
+    SpscQueue<MappedBatch> mWriteQueue;
+    SpscQueue<MappedBatch> mFreeMapped;
+    // Счет записанных пакетов NEVOD: приемник -> этап записи
+    SpscQueue<RunCounters::Batch> mNevodCounts;
+    std::atomic<uintmax_t> mReadStalls;
+    std::atomic<uintmax_t> mDecodeStalls;
+    std::atomic<uintmax_t> mMapStalls;
+    std::atomic_bool mReadDone;
+    std::atomic_bool mDecodeDone;
+    std::atomic_bool mMapDone;
+    // Каталог набора и meta создаются до запуска этапов
+    std::string mRunDir;
+    std::string mMetaFilename;
+    // Модули, настройки которых пишутся в meta набора помимо читаемого
+    std::vector<std::shared_ptr<Tdc>> mMetaModules;
 	    
-    uintmax_t mTrgCount[2];
-    
-    uintmax_t mPkgCount[2];
-    
-    TrekHitCount mChambersCount[2];
+    // Писатель счетчиков записанных событий - этап записи,
+    // отброшенных - приемник NEVOD
+    RunCounters mCounters[2];
     
     std::atomic_bool mActive;
     std::function<void(TrekFreq)> mOnMonitor;
@@ -78,4 +132,4 @@ private:
 };
 
 
-TrekFreq convertFreq(const ChannelFreq& freq, const ChannelConfig& conf);
+TrekFreq convertFreq(const ChannelFreq& freq, const ChannelTable& table);
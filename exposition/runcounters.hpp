@@ -0,0 +1,131 @@
+#pragma once
+
+#include "channelconfig.hpp"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/*
+ * Счетчики набора с одним потоком-писателем. Счет пакета копится в Batch
+ * и применяется писателем через add(), читатели из других потоков получают
+ * согласованный снимок по seqlock и не блокируют писателя.
+ */
+class RunCounters {
+    static constexpr size_t cacheLine = 64;
+    static constexpr size_t wires = std::tuple_size<ChamberHitCount>::value;
+    using Counter = std::atomic<uintmax_t>;
+    // Отступ массива хитов от соседних выделений памяти
+    static constexpr size_t pad = cacheLine / sizeof(Counter);
+public:
+    struct Snapshot {
+        uintmax_t triggers;
+        uintmax_t packages;
+        uintmax_t unmapped;
+        // Индекс - номер камеры
+        std::vector<ChamberHitCount> chambers;
+    };
+    // Счет пакета событий без атомарных операций, применяется писателем через add()
+    class Batch {
+        friend class RunCounters;
+    public:
+        void reset(size_t chambers) {
+            mTriggers = 0;
+            mPackages = 0;
+            mUnmapped = 0;
+            mHits.assign(chambers*wires, 0);
+        }
+        void addTriggers(uintmax_t n) { mTriggers += n; }
+        void addPackages(uintmax_t n) { mPackages += n; }
+        void addUnmapped(uintmax_t n) { mUnmapped += n; }
+        void addHit(unsigned chamber, unsigned wire) { ++mHits[chamber*wires + wire]; }
+    private:
+        uintmax_t mTriggers = 0;
+        uintmax_t mPackages = 0;
+        uintmax_t mUnmapped = 0;
+        std::vector<uintmax_t> mHits;
+    };
+public:
+    RunCounters()
+        : mSequence(0),
+          mTriggers(0),
+          mPackages(0),
+          mUnmapped(0),
+          mHits(nullptr),
+          mChambers(0) { }
+
+    RunCounters(const RunCounters&) = delete;
+    RunCounters& operator=(const RunCounters&) = delete;
+
+    // Вызывается до запуска писателя и читателей
+    void reset(size_t chambers) {
+        mStorage.reset(new Counter[chambers*wires + 2*pad]());
+        mHits = mStorage.get() + pad;
+        mChambers = chambers;
+        mSequence = 0;
+        mTriggers = 0;
+        mPackages = 0;
+        mUnmapped = 0;
+    }
+
+    // Одна запись на пакет; batch.reset() вызван с тем же числом камер
+    void add(const Batch& batch) {
+        beginWrite();
+        add(mTriggers, batch.mTriggers);
+        add(mPackages, batch.mPackages);
+        add(mUnmapped, batch.mUnmapped);
+        for(size_t i = 0; i < batch.mHits.size(); ++i) {
+            if(batch.mHits[i] != 0)
+                add(mHits[i], batch.mHits[i]);
+        }
+        endWrite();
+    }
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        s.chambers.resize(mChambers);
+        while(true) {
+            auto begin = mSequence.load(std::memory_order_acquire);
+            if(begin & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            s.triggers = load(mTriggers);
+            s.packages = load(mPackages);
+            s.unmapped = load(mUnmapped);
+            for(size_t c = 0; c < mChambers; ++c)
+                for(size_t w = 0; w < wires; ++w)
+                    s.chambers[c][w] = load(mHits[c*wires + w]);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(mSequence.load(std::memory_order_relaxed) == begin)
+                return s;
+        }
+    }
+protected:
+    void beginWrite() {
+        mSequence.store(mSequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    void endWrite() {
+        mSequence.store(mSequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    //Писатель один, чтение-изменение-запись не требует атомарной операции
+    static void add(Counter& c, uintmax_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static uintmax_t load(const Counter& c) {
+        return c.load(std::memory_order_relaxed);
+    }
+private:
+    //Объекты разных писателей не делят строки кэша, номер seqlock - отдельно
+    //от счетчиков. В куче выравнивание соблюдается с -faligned-new
+    alignas(cacheLine) std::atomic<unsigned> mSequence;
+    alignas(cacheLine) Counter mTriggers;
+    Counter mPackages;
+    Counter mUnmapped;
+    std::unique_ptr<Counter[]> mStorage;
+    Counter* mHits;
+    size_t  mChambers;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/*
+ * Кольцевой буфер фиксированной емкости для одного писателя и одного читателя.
+ * Заполненная очередь не блокирует: tryPush() возвращает false, и решение
+ * о задержке принимает этап-писатель.
+ */
+template<typename T>
+class SpscQueue {
+    static constexpr size_t cacheLine = 64;
+    using Index = std::atomic<size_t>;
+public:
+    explicit SpscQueue(size_t capacity)
+        : mSlots(capacity + 1),
+          mHead(0),
+          mTail(0),
+          mHighWater(0) { }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Значение перемещается только при успешной записи
+    bool tryPush(T& value) {
+        auto tail = mTail.load(std::memory_order_relaxed);
+        auto next = advance(tail);
+        if(next == mHead.load(std::memory_order_acquire))
+            return false;
+        mSlots[tail] = std::move(value);
+        mTail.store(next, std::memory_order_release);
+        auto depth = size();
+        if(depth > mHighWater.load(std::memory_order_relaxed))
+            mHighWater.store(depth, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool tryPop(T& value) {
+        auto head = mHead.load(std::memory_order_relaxed);
+        if(head == mTail.load(std::memory_order_acquire))
+            return false;
+        value = std::move(mSlots[head]);
+        mHead.store(advance(head), std::memory_order_release);
+        return true;
+    }
+
+    bool full() const {
+        return advance(mTail.load(std::memory_order_acquire)) == mHead.load(std::memory_order_acquire);
+    }
+    bool empty() const {
+        return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+    }
+    size_t size() const {
+        auto head = mHead.load(std::memory_order_acquire);
+        auto tail = mTail.load(std::memory_order_acquire);
+        return tail >= head ? tail - head : tail + mSlots.size() - head;
+    }
+    size_t capacity() const { return mSlots.size() - 1; }
+    size_t highWater() const { return mHighWater.load(std::memory_order_relaxed); }
+protected:
+    size_t advance(size_t i) const { return i + 1 == mSlots.size() ? 0 : i + 1; }
+private:
+    std::vector<T> mSlots;
+    //Индексы читателя и писателя в разных строках кэша
+    char  mPad0[cacheLine];
+    Index mHead;
+    char  mPad1[cacheLine - sizeof(Index)];
+    Index mTail;
+    char  mPad2[cacheLine - sizeof(Index)];
+    std::atomic<size_t> mHighWater;
+};
@@ -24,6 +24,8 @@ using std::endl;
 using std::string;
 using std::istreambuf_iterator;
 using std::make_shared;
+using std::shared_ptr;
+using std::vector;
 using std::chrono::system_clock;
 using trek::StringBuilder;
 
@@ -55,8 +57,24 @@ int main() {
         fatal(StringBuilder() << "Failed parse channels.conf: " << e.what());
     }
 
-    auto caentdc = make_shared<CaenV2718>(0xEE00);
+    if(appSettings.caenConfig.empty())
+        fatal("CtudcServer.conf: caen board list is empty");
+    vector<CaenCrate::Board> boards;
+    for(auto& b : appSettings.caenConfig)
+        boards.push_back({make_shared<CaenV2718>(b.address, b.link, b.board), b.channelOffset});
+    auto crate = make_shared<CaenCrate>(boards);
+    auto caentdc = boards.front().module;
     auto emisstdc = make_shared<EmissTdc>();
+    shared_ptr<Tdc> expotdc = emisstdc;
+    if(appSettings.expoTdc == "caen") {
+        expotdc = crate;
+        //Модули крейта открываются при запуске, контроллер tdc управляет только первым
+        try {
+            crate->open();
+        } catch(std::exception& e) {
+            std::cerr << "CAEN: " << e.what() << std::endl;
+        }
+    }
     auto ftd = make_shared<ftdi::Module>(0x28);
     auto vlt = make_shared<Amplifier>();
     vlt->setTimeout(5000);
@@ -70,14 +88,16 @@ int main() {
     auto tdcController  = make_shared<Caen2718Contr>("tdc", caentdc);
     auto emissController= make_shared<EmissContr>("emiss", emisstdc);
     auto vltController  = make_shared<VoltageContr>("vlt", vlt, ftd, appSettings.voltConfig);
-    auto expoController = make_shared<ExpoContr>("expo", emisstdc, appSettings.expoConfig, channelParser.getConfig());
+    //Режим передачи CAEN пишется в meta каждого набора, какой бы модуль ни читался
+    auto expoController = make_shared<ExpoContr>("expo", expotdc, appSettings.expoConfig, channelParser.getConfig(),
+                                                 vector<shared_ptr<Tdc>>{crate});
     expoController->onNewRun() = [&](unsigned nRun) {
         appSettings.expoConfig.nRun = nRun;
         appSettings.save(confPath + "CtudcServer.conf");
     };
     
 
-    trek::net::Server server({emissController, expoController, vltController}, appSettings.ip, appSettings.port);
+    trek::net::Server server({tdcController, emissController, expoController, vltController}, appSettings.ip, appSettings.port);
     server.onStart() = [](const auto&) {
         std::cout << system_clock::now() << " Server start" << endl;
     };
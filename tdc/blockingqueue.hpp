@@ -0,0 +1,84 @@
+#pragma once
+
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+/*
+ * Очередь для передачи буферов между потоками.
+ * После close() ожидающие pop() возвращают false, как только очередь опустеет.
+ */
+template<typename T>
+class BlockingQueue {
+    using Mutex = std::mutex;
+    using Lock = std::unique_lock<Mutex>;
+public:
+    BlockingQueue() : mClosed(false) { }
+
+    void push(T value) {
+        {
+            Lock lk(mMutex);
+            mQueue.push_back(std::move(value));
+        }
+        mCv.notify_one();
+    }
+
+    template<typename Rep, typename Period>
+    bool pop(T& value, std::chrono::duration<Rep, Period> timeout) {
+        Lock lk(mMutex);
+        if(!mCv.wait_for(lk, timeout, [this] { return !mQueue.empty() || mClosed; }))
+            return false;
+        return popLocked(value);
+    }
+
+    // Ожидание элемента без извлечения, false по истечении timeout или после close()
+    template<typename Rep, typename Period>
+    bool wait(std::chrono::duration<Rep, Period> timeout) const {
+        Lock lk(mMutex);
+        mCv.wait_for(lk, timeout, [this] { return !mQueue.empty() || mClosed; });
+        return !mQueue.empty();
+    }
+
+    bool tryPop(T& value) {
+        Lock lk(mMutex);
+        return popLocked(value);
+    }
+
+    void close() {
+        {
+            Lock lk(mMutex);
+            mClosed = true;
+        }
+        mCv.notify_all();
+    }
+
+    void clear() {
+        Lock lk(mMutex);
+        mQueue.clear();
+    }
+
+    void reopen() {
+        Lock lk(mMutex);
+        mQueue.clear();
+        mClosed = false;
+    }
+
+    size_t size() const {
+        Lock lk(mMutex);
+        return mQueue.size();
+    }
+protected:
+    bool popLocked(T& value) {
+        if(mQueue.empty())
+            return false;
+        value = std::move(mQueue.front());
+        mQueue.pop_front();
+        return true;
+    }
+private:
+    std::deque<T> mQueue;
+    bool mClosed;
+    mutable Mutex mMutex;
+    mutable std::condition_variable mCv;
+};
@@ -0,0 +1,278 @@
+#include "caencrate.hpp"
+
+#include <trek/common/stringbuilder.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+
+using std::string;
+using std::vector;
+using std::logic_error;
+using std::runtime_error;
+using trek::StringBuilder;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+
+using nlohmann::json;
+
+//Событие, которого нет у части модулей, ждет остальные не дольше mergeTimeout
+static constexpr milliseconds mergeTimeout(500);
+static constexpr milliseconds readTimeout(100);
+
+static bool triggerBefore(uint32_t a, uint32_t b) {
+    return ((a - b) & CaenDecoder::eventCountMask) > CaenDecoder::eventCountMask / 2;
+}
+
+CaenCrate::CaenCrate(const vector<Board>& boards)
+    : mBoards(boards),
+      mPending(boards.size()),
+      mActive(false),
+      mIncomplete(0) {
+    if(mBoards.empty())
+        throw logic_error("CaenCrate::CaenCrate no boards");
+}
+
+CaenCrate::~CaenCrate() {
+    Lock lk(mMutex);
+    stopReaders();
+}
+
+//Если модуль не открылся, открытые этим вызовом модули закрываются
+void CaenCrate::open() {
+    vector<size_t> opened;
+    for(size_t i = 0; i < mBoards.size(); ++i) {
+        if(mBoards[i].module->isOpen())
+            continue;
+        try {
+            mBoards[i].module->open();
+            opened.push_back(i);
+        } catch(std::exception& e) {
+            for(auto j : opened)
+                mBoards[j].module->close();
+            throw runtime_error(StringBuilder() << "CaenCrate::open board " << i << ": " << e.what());
+        }
+    }
+}
+
+void CaenCrate::close() {
+    Lock lk(mMutex);
+    stopReaders();
+    for(auto& b : mBoards)
+        b.module->close();
+}
+
+void CaenCrate::readEvents(EventBatch& batch) {
+    Lock lk(mMutex);
+    startReaders();
+    batch.clear();
+    Input input;
+    while(mInput.tryPop(input))
+        pushInput(input);
+    mergeEvents(batch);
+}
+
+void CaenCrate::waitEvents(milliseconds timeout) {
+    {
+        Lock lk(mMutex);
+        startReaders();
+        auto ready = std::all_of(mPending.begin(), mPending.end(), [](auto& p) { return !p.batches.empty(); });
+        if(ready)
+            return;
+    }
+    Input input;
+    if(mInput.pop(input, timeout)) {
+        Lock lk(mMutex);
+        pushInput(input);
+    }
+}
+
+void CaenCrate::readHits(vector<Hit>& buffer) {
+    Lock lk(mMutex);
+    stopReaders();
+    buffer.clear();
+    vector<Hit> hits;
+    for(auto& b : mBoards) {
+        b.module->readHits(hits);
+        for(auto& hit : hits)
+            buffer.emplace_back(hit.type, hit.channel + b.channelOffset, hit.time);
+    }
+}
+
+const string& CaenCrate::name() const {
+    static string n("CaenCrate");
+    return n;
+}
+
+void CaenCrate::printMeta(std::ostream& stream) const {
+    for(size_t i = 0; i < mBoards.size(); ++i) {
+        auto& b = mBoards[i];
+        stream << "Board " << i << ":        link " << b.module->link()
+               << " board " << b.module->board()
+               << " address 0x" << std::hex << b.module->baseAddress() << std::dec
+               << " channel offset " << b.channelOffset << '\n';
+        b.module->printMeta(stream);
+    }
+}
+
+Tdc::Settings CaenCrate::settings() {
+    return mBoards.front().module->settings();
+}
+
+bool CaenCrate::isOpen() const {
+    return std::all_of(mBoards.begin(), mBoards.end(), [](auto& b) { return b.module->isOpen(); });
+}
+
+void CaenCrate::clear() {
+    Lock lk(mMutex);
+    stopReaders();
+    for(auto& b : mBoards)
+        b.module->clear();
+}
+
+Tdc::Mode CaenCrate::mode() {
+    return mBoards.front().module->mode();
+}
+
+void CaenCrate::setMode(Mode mode) {
+    Lock lk(mMutex);
+    stopReaders();
+    for(auto& b : mBoards)
+        b.module->setMode(mode);
+}
+
+uintmax_t CaenCrate::incompleteEvents() const {
+    return mIncomplete;
+}
+
+void CaenCrate::startReaders() {
+    if(!mReaders.empty())
+        return;
+    mInput.reopen();
+    mActive = true;
+    for(size_t i = 0; i < mBoards.size(); ++i)
+        mReaders.emplace_back(&CaenCrate::readLoop, this, i);
+}
+
+void CaenCrate::stopReaders() {
+    if(mReaders.empty())
+        return;
+    mActive = false;
+    mInput.close();
+    for(auto& t : mReaders)
+        t.join();
+    mReaders.clear();
+    mInput.reopen();
+    for(auto& p : mPending) {
+        p.batches.clear();
+        p.event = 0;
+    }
+}
+
+void CaenCrate::readLoop(size_t board) {
+    auto& module = *mBoards[board].module;
+    EventBatch batch;
+    while(mActive) {
+        try {
+            module.waitEvents(readTimeout);
+            module.readEvents(batch);
+        } catch(std::exception& e) {
+            std::cerr << "CaenCrate::readLoop board " << board << ": " << e.what() << std::endl;
+            std::this_thread::sleep_for(readTimeout);
+            continue;
+        }
+        if(batch.empty())
+            continue;
+        mInput.push({board, std::move(batch)});
+        batch = EventBatch();
+    }
+}
+
+void CaenCrate::pushInput(Input& input) {
+    if(!input.batch.empty())
+        mPending.at(input.board).batches.push_back(std::move(input.batch));
+}
+
+const EventBatch* CaenCrate::head(size_t board) const {
+    auto& p = mPending[board];
+    return p.batches.empty() ? nullptr : &p.batches.front();
+}
+
+void CaenCrate::advance(size_t board) {
+    auto& p = mPending[board];
+    if(++p.event == p.batches.front().eventCount()) {
+        p.batches.pop_front();
+        p.event = 0;
+    }
+}
+
+/*
+ * Выдается событие с наименьшим номером триггера среди первых событий модулей.
+ * Пока у какого-то модуля нет данных, объединение ждет его до mergeTimeout.
+ */
+void CaenCrate::mergeEvents(EventBatch& batch) {
+    auto now = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    while(true) {
+        bool found = false;
+        bool complete = true;
+        uint32_t trigger = 0;
+        auto oldest = std::numeric_limits<int64_t>::max();
+        for(size_t b = 0; b < mBoards.size(); ++b) {
+            auto h = head(b);
+            if(h == nullptr) {
+                complete = false;
+                continue;
+            }
+            auto event = mPending[b].event;
+            if(!found || triggerBefore(h->trigger(event), trigger))
+                trigger = h->trigger(event);
+            oldest = std::min(oldest, h->timestamp(event));
+            found = true;
+        }
+        if(!found)
+            break;
+        if(!complete && now - oldest < duration_cast<nanoseconds>(mergeTimeout).count())
+            break;
+
+        int64_t timestamp = 0;
+        for(size_t b = 0; b < mBoards.size(); ++b) {
+            auto h = head(b);
+            if(h != nullptr && h->trigger(mPending[b].event) == trigger)
+                timestamp = std::max(timestamp, h->timestamp(mPending[b].event));
+        }
+        batch.beginEvent(trigger, timestamp);
+        size_t parts = 0;
+        for(size_t b = 0; b < mBoards.size(); ++b) {
+            auto h = head(b);
+            auto event = mPending[b].event;
+            if(h == nullptr || h->trigger(event) != trigger)
+                continue;
+            auto offset = mBoards[b].channelOffset;
+            for(auto i = h->eventBegin(event); i < h->eventEnd(event); ++i)
+                batch.addHit(h->channel(i) + offset, h->time(i), h->edge(i));
+            advance(b);
+            ++parts;
+        }
+        if(parts != mBoards.size())
+            ++mIncomplete;
+    }
+}
+
+json CaenCrate::BoardSettings::marshal() const {
+    return {
+        {"link", link},
+        {"board", board},
+        {"address", address},
+        {"channel_offset", channelOffset},
+    };
+}
+
+void CaenCrate::BoardSettings::unMarshal(const json& doc) {
+    link = doc.at("link");
+    board = doc.at("board");
+    address = doc.at("address");
+    channelOffset = doc.at("channel_offset");
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "caenv2718.hpp"
+#include "blockingqueue.hpp"
+
+#include <json.hpp>
+
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+/*
+ * Несколько модулей CAEN, каждый читается в своем потоке.
+ * События модулей объединяются по номеру триггера, каналы модуля
+ * сдвигаются на channelOffset, образуя общее пространство каналов.
+ */
+class CaenCrate : public Tdc {
+    using Mutex = std::mutex;
+    using Lock = std::lock_guard<Mutex>;
+    using ModulePtr = std::shared_ptr<CaenV2718>;
+public:
+    struct BoardSettings {
+        short    link;
+        short    board;
+        unsigned address;
+        unsigned channelOffset;
+
+        nlohmann::json marshal() const;
+        void unMarshal(const nlohmann::json& doc);
+    };
+    struct Board {
+        ModulePtr module;
+        unsigned  channelOffset;
+    };
+public:
+    explicit CaenCrate(const std::vector<Board>& boards);
+    ~CaenCrate();
+
+    void open();
+    void close();
+
+    void readEvents(EventBatch& batch) override;
+    void readHits(std::vector<Hit>& buffer) override;
+    void waitEvents(std::chrono::milliseconds timeout) override;
+    const std::string& name() const override;
+    void printMeta(std::ostream& stream) const override;
+    Settings settings() override;
+    bool isOpen() const override;
+    void clear() override;
+    Mode mode() override;
+    void setMode(Mode mode) override;
+
+    // События, для которых хотя бы один модуль не прислал данные
+    uintmax_t incompleteEvents() const;
+protected:
+    struct Input {
+        size_t     board;
+        EventBatch batch;
+    };
+    struct Pending {
+        std::deque<EventBatch> batches;
+        size_t event;
+    };
+
+    void startReaders();
+    void stopReaders();
+    void readLoop(size_t board);
+    void pushInput(Input& input);
+    void mergeEvents(EventBatch& batch);
+    const EventBatch* head(size_t board) const;
+    void advance(size_t board);
+private:
+    std::vector<Board> mBoards;
+    std::vector<Pending> mPending;
+    std::vector<std::thread> mReaders;
+    BlockingQueue<Input> mInput;
+    std::atomic_bool mActive;
+    std::atomic<uintmax_t> mIncomplete;
+    Mutex mMutex;
+};
@@ -0,0 +1,272 @@
+#include "caendecoder.hpp"
+
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CAEN_DECODER_X86
+#include <immintrin.h>
+#endif
+
+using std::vector;
+using std::logic_error;
+
+static constexpr uint32_t DATA_TYPE_MSK = 0xf8000000; /* Data type bit masks */
+static constexpr uint32_t HEADER = 0x40000000;      /* Global header data type */
+static constexpr uint32_t TRAILER = 0x80000000;     /* Global trailer data type */
+static constexpr uint32_t TDC_MEASURE = 0x00000000; /* TDC measure data type */
+/* Filler (0xC0000000) pads MBLT64 transfers to 64 bits; like other types it is skipped */
+static constexpr uint32_t TDC_MSR_CHANNEL_MSK = 0x03f80000;
+static constexpr uint32_t TDC_MSR_MEASURE_MSK = 0x0007ffff;
+static constexpr uint32_t TDC_MSR_EDGE_BIT = 26;
+static constexpr uint32_t TDC_MSR_CHANNEL_SHIFT = 19;
+static constexpr uint32_t HDR_EVENT_COUNT_SHIFT = 5;
+
+static unsigned time(uint32_t data) { return (data & TDC_MSR_MEASURE_MSK);}
+static unsigned chan(uint32_t data) { return (data & TDC_MSR_CHANNEL_MSK) >> TDC_MSR_CHANNEL_SHIFT;}
+static bool isGlobalHeader(uint32_t data) { return (data & DATA_TYPE_MSK) == HEADER;}
+static bool isGlobalTrailer(uint32_t data) {return (data & DATA_TYPE_MSK) == TRAILER;}
+static bool isMeasurement(uint32_t data) {return (data & DATA_TYPE_MSK) == TDC_MEASURE;}
+static uint32_t eventCount(uint32_t data) { return (data >> HDR_EVENT_COUNT_SHIFT) & CaenDecoder::eventCountMask;}
+static Tdc::EdgeDetection edgeDetection(uint32_t data) {
+    if((data >> TDC_MSR_EDGE_BIT) > 0)
+        return Tdc::EdgeDetection::trailing;
+    return Tdc::EdgeDetection::leading;
+}
+
+/*
+ * Пропуски в номерах событий считаются при разборе заголовка,
+ * отдельного прохода по пакету не требуется.
+ */
+struct EventState {
+    int64_t timestamp;
+    bool header;
+    CaenDecoder::Sequence& sequence;
+};
+
+static void beginEvent(uint32_t data, EventState& state, EventBatch& batch) {
+    auto& seq = state.sequence;
+    auto count = eventCount(data);
+    if(seq.valid && count != seq.next) {
+        ++seq.gaps;
+        seq.lost += (count - seq.next) & CaenDecoder::eventCountMask;
+    }
+    seq.valid = true;
+    seq.next = (count + 1) & CaenDecoder::eventCountMask;
+    batch.beginEvent(count, state.timestamp);
+    state.header = true;
+}
+
+static void decodeEventsScalar(unsigned lsb, const uint32_t* data, size_t size, EventState& state, EventBatch& batch) {
+    for(size_t i = 0; i < size; ++i) {
+        if(isMeasurement(data[i]) && !batch.empty() )
+            batch.addHit(chan(data[i]), lsb * time(data[i]), uint8_t(edgeDetection(data[i])));
+        else if(isGlobalHeader(data[i]) && !state.header)
+            beginEvent(data[i], state, batch);
+        else if(isGlobalTrailer(data[i]) && state.header)
+            state.header = false;
+    }
+}
+
+static void decodeHitsScalar(unsigned lsb, const uint32_t* data, size_t size, vector<Tdc::Hit>& buffer) {
+    for(size_t i = 0; i < size; ++i)
+        if(isMeasurement(data[i]) )
+            buffer.emplace_back(edgeDetection(data[i]), chan(data[i]), lsb * time(data[i]));
+}
+
+#ifdef CAEN_DECODER_X86
+
+/*
+ * Поля всех слов блока уже извлечены векторно, здесь только раскладываются
+ * измерения по событиям. Управляющие слова (заголовок/окончание) обрабатываются
+ * в порядке следования, поэтому результат совпадает со скалярным декодером.
+ */
+static void emitEventBlock(const uint32_t* words,
+                           const uint32_t* chans,
+                           const uint32_t* times,
+                           const uint32_t* edges,
+                           unsigned measMask,
+                           unsigned ctrlMask,
+                           EventState& state,
+                           EventBatch& batch) {
+    auto lanes = measMask | ctrlMask;
+    while(lanes != 0) {
+        auto j = unsigned(__builtin_ctz(lanes));
+        lanes &= lanes - 1;
+        if(((ctrlMask >> j) & 1) == 0) {
+            if(!batch.empty())
+                batch.addHit(chans[j], times[j], uint8_t(edges[j]));
+        } else if(isGlobalHeader(words[j]) && !state.header) {
+            beginEvent(words[j], state, batch);
+        } else if(isGlobalTrailer(words[j]) && state.header) {
+            state.header = false;
+        }
+    }
+}
+
+static void emitHitBlock(const uint32_t* chans,
+                         const uint32_t* times,
+                         const uint32_t* edges,
+                         unsigned measMask,
+                         vector<Tdc::Hit>& buffer) {
+    while(measMask != 0) {
+        auto j = unsigned(__builtin_ctz(measMask));
+        measMask &= measMask - 1;
+        buffer.emplace_back(Tdc::EdgeDetection(edges[j]), chans[j], times[j]);
+    }
+}
+
+__attribute__((target("sse2")))
+static inline __m128i mullo32Sse2(__m128i a, __m128i b) {
+    auto even = _mm_mul_epu32(a, b);
+    auto odd  = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__attribute__((target("sse2")))
+static void decodeEventsSse2(unsigned lsb, const uint32_t* data, size_t size, EventState& state, EventBatch& batch) {
+    const auto typeMsk = _mm_set1_epi32(int(DATA_TYPE_MSK));
+    const auto hdr     = _mm_set1_epi32(int(HEADER));
+    const auto trl     = _mm_set1_epi32(int(TRAILER));
+    const auto chanMsk = _mm_set1_epi32(int(TDC_MSR_CHANNEL_MSK));
+    const auto timeMsk = _mm_set1_epi32(int(TDC_MSR_MEASURE_MSK));
+    const auto one     = _mm_set1_epi32(1);
+    const auto vlsb    = _mm_set1_epi32(int(lsb));
+    alignas(16) uint32_t chans[4], times[4], edges[4];
+
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4) {
+        auto v    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        auto type = _mm_and_si128(v, typeMsk);
+        auto meas = _mm_cmpeq_epi32(type, _mm_setzero_si128());
+        auto ctrl = _mm_or_si128(_mm_cmpeq_epi32(type, hdr), _mm_cmpeq_epi32(type, trl));
+        auto measMask = unsigned(_mm_movemask_ps(_mm_castsi128_ps(meas)));
+        auto ctrlMask = unsigned(_mm_movemask_ps(_mm_castsi128_ps(ctrl)));
+        if(ctrlMask == 0 && (measMask == 0 || batch.empty()))
+            continue;
+        _mm_store_si128(reinterpret_cast<__m128i*>(chans), _mm_srli_epi32(_mm_and_si128(v, chanMsk), TDC_MSR_CHANNEL_SHIFT));
+        _mm_store_si128(reinterpret_cast<__m128i*>(times), mullo32Sse2(_mm_and_si128(v, timeMsk), vlsb));
+        _mm_store_si128(reinterpret_cast<__m128i*>(edges), _mm_and_si128(_mm_srli_epi32(v, TDC_MSR_EDGE_BIT), one));
+        emitEventBlock(data + i, chans, times, edges, measMask, ctrlMask, state, batch);
+    }
+    decodeEventsScalar(lsb, data + i, size - i, state, batch);
+}
+
+__attribute__((target("sse2")))
+static void decodeHitsSse2(unsigned lsb, const uint32_t* data, size_t size, vector<Tdc::Hit>& buffer) {
+    const auto typeMsk = _mm_set1_epi32(int(DATA_TYPE_MSK));
+    const auto chanMsk = _mm_set1_epi32(int(TDC_MSR_CHANNEL_MSK));
+    const auto timeMsk = _mm_set1_epi32(int(TDC_MSR_MEASURE_MSK));
+    const auto one     = _mm_set1_epi32(1);
+    const auto vlsb    = _mm_set1_epi32(int(lsb));
+    alignas(16) uint32_t chans[4], times[4], edges[4];
+
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4) {
+        auto v    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        auto meas = _mm_cmpeq_epi32(_mm_and_si128(v, typeMsk), _mm_setzero_si128());
+        auto measMask = unsigned(_mm_movemask_ps(_mm_castsi128_ps(meas)));
+        if(measMask == 0)
+            continue;
+        _mm_store_si128(reinterpret_cast<__m128i*>(chans), _mm_srli_epi32(_mm_and_si128(v, chanMsk), TDC_MSR_CHANNEL_SHIFT));
+        _mm_store_si128(reinterpret_cast<__m128i*>(times), mullo32Sse2(_mm_and_si128(v, timeMsk), vlsb));
+        _mm_store_si128(reinterpret_cast<__m128i*>(edges), _mm_and_si128(_mm_srli_epi32(v, TDC_MSR_EDGE_BIT), one));
+        emitHitBlock(chans, times, edges, measMask, buffer);
+    }
+    decodeHitsScalar(lsb, data + i, size - i, buffer);
+}
+
+__attribute__((target("avx2")))
+static void decodeEventsAvx2(unsigned lsb, const uint32_t* data, size_t size, EventState& state, EventBatch& batch) {
+    const auto typeMsk = _mm256_set1_epi32(int(DATA_TYPE_MSK));
+    const auto hdr     = _mm256_set1_epi32(int(HEADER));
+    const auto trl     = _mm256_set1_epi32(int(TRAILER));
+    const auto chanMsk = _mm256_set1_epi32(int(TDC_MSR_CHANNEL_MSK));
+    const auto timeMsk = _mm256_set1_epi32(int(TDC_MSR_MEASURE_MSK));
+    const auto one     = _mm256_set1_epi32(1);
+    const auto vlsb    = _mm256_set1_epi32(int(lsb));
+    alignas(32) uint32_t chans[8], times[8], edges[8];
+
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        auto v    = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        auto type = _mm256_and_si256(v, typeMsk);
+        auto meas = _mm256_cmpeq_epi32(type, _mm256_setzero_si256());
+        auto ctrl = _mm256_or_si256(_mm256_cmpeq_epi32(type, hdr), _mm256_cmpeq_epi32(type, trl));
+        auto measMask = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(meas)));
+        auto ctrlMask = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(ctrl)));
+        if(ctrlMask == 0 && (measMask == 0 || batch.empty()))
+            continue;
+        _mm256_store_si256(reinterpret_cast<__m256i*>(chans), _mm256_srli_epi32(_mm256_and_si256(v, chanMsk), TDC_MSR_CHANNEL_SHIFT));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(times), _mm256_mullo_epi32(_mm256_and_si256(v, timeMsk), vlsb));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(edges), _mm256_and_si256(_mm256_srli_epi32(v, TDC_MSR_EDGE_BIT), one));
+        emitEventBlock(data + i, chans, times, edges, measMask, ctrlMask, state, batch);
+    }
+    decodeEventsScalar(lsb, data + i, size - i, state, batch);
+}
+
+__attribute__((target("avx2")))
+static void decodeHitsAvx2(unsigned lsb, const uint32_t* data, size_t size, vector<Tdc::Hit>& buffer) {
+    const auto typeMsk = _mm256_set1_epi32(int(DATA_TYPE_MSK));
+    const auto chanMsk = _mm256_set1_epi32(int(TDC_MSR_CHANNEL_MSK));
+    const auto timeMsk = _mm256_set1_epi32(int(TDC_MSR_MEASURE_MSK));
+    const auto one     = _mm256_set1_epi32(1);
+    const auto vlsb    = _mm256_set1_epi32(int(lsb));
+    alignas(32) uint32_t chans[8], times[8], edges[8];
+
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        auto v    = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        auto meas = _mm256_cmpeq_epi32(_mm256_and_si256(v, typeMsk), _mm256_setzero_si256());
+        auto measMask = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(meas)));
+        if(measMask == 0)
+            continue;
+        _mm256_store_si256(reinterpret_cast<__m256i*>(chans), _mm256_srli_epi32(_mm256_and_si256(v, chanMsk), TDC_MSR_CHANNEL_SHIFT));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(times), _mm256_mullo_epi32(_mm256_and_si256(v, timeMsk), vlsb));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(edges), _mm256_and_si256(_mm256_srli_epi32(v, TDC_MSR_EDGE_BIT), one));
+        emitHitBlock(chans, times, edges, measMask, buffer);
+    }
+    decodeHitsScalar(lsb, data + i, size - i, buffer);
+}
+
+#endif
+
+CaenDecoder::CaenDecoder(Isa isa)
+    : mIsa(isa) {
+    if(int(isa) > int(supportedIsa()))
+        throw logic_error("CaenDecoder::CaenDecoder isa is not supported");
+}
+
+void CaenDecoder::decodeEvents(unsigned lsb,
+                               const uint32_t* data,
+                               size_t size,
+                               int64_t timestamp,
+                               Sequence& sequence,
+                               EventBatch& batch) const {
+    //Хитов не больше, чем слов, поэтому при декодировании память не перераспределяется
+    batch.reserveAppend(size/2, size);
+    EventState state{timestamp, false, sequence};
+    switch(mIsa) {
+#ifdef CAEN_DECODER_X86
+    case Isa::avx2:
+        return decodeEventsAvx2(lsb, data, size, state, batch);
+    case Isa::sse2:
+        return decodeEventsSse2(lsb, data, size, state, batch);
+#endif
+    default:
+        return decodeEventsScalar(lsb, data, size, state, batch);
+    }
+}
+
+void CaenDecoder::decodeHits(unsigned lsb, const uint32_t* data, size_t size, vector<Tdc::Hit>& buffer) const {
+    switch(mIsa) {
+#ifdef CAEN_DECODER_X86
+    case Isa::avx2:
+        return decodeHitsAvx2(lsb, data, size, buffer);
+    case Isa::sse2:
+        return decodeHitsSse2(lsb, data, size, buffer);
+#endif
+    default:
+        return decodeHitsScalar(lsb, data, size, buffer);
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "tdc.hpp"
+#include "simdisa.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Декодер выходного буфера CAEN V2718.
+ * Слова классифицируются блоками по 8 (AVX2) или 4 (SSE2) слова,
+ * набор инструкций выбирается во время выполнения.
+ */
+class CaenDecoder {
+public:
+    using Isa = SimdIsa;
+    // Номера событий из глобальных заголовков, непрерывность проверяется между вызовами
+    struct Sequence {
+        bool      valid = false;
+        uint32_t  next  = 0;
+        uintmax_t gaps  = 0;
+        uintmax_t lost  = 0;
+    };
+public:
+    explicit CaenDecoder(Isa isa = supportedIsa());
+
+    // Декодированные данные дописываются в конец batch/buffer
+    void decodeEvents(unsigned lsb,
+                      const uint32_t* data,
+                      size_t size,
+                      int64_t timestamp,
+                      Sequence& sequence,
+                      EventBatch& batch) const;
+    void decodeHits(unsigned lsb, const uint32_t* data, size_t size, std::vector<Tdc::Hit>& buffer) const;
+
+    Isa isa() const { return mIsa; }
+    static Isa supportedIsa() { return supportedSimdIsa(); }
+    static constexpr uint32_t eventCountMask = 0x3FFFFF;
+private:
+    Isa mIsa;
+};
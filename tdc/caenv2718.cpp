@@ -2,6 +2,9 @@
 
 #include <CAENVMElib.h>
 
+#include <algorithm>
+#include <cassert>
+#include <iostream>
 #include <chrono>
 #include <thread>
 
@@ -9,14 +12,20 @@ using std::string;
 using std::vector;
 using std::runtime_error;
 using std::logic_error;
+using std::make_unique;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
-using std::chrono::system_clock;
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
 
 enum class CaenV2718::Reg : uint16_t {
     outputBuffer  = 0x0000,
     controlReg    = 0x1000,
     statusReg     = 0x1002,
+    interruptLevel  = 0x100A,
+    interruptVector = 0x100C,
     softwareReset = 0x1014,
     softwareClear = 0x1016,
     eventReset    = 0x1018,
@@ -50,47 +59,65 @@ enum class CaenV2718::OpCode : uint16_t {
     microRev       = 0x6100
 };
 
-static constexpr uint32_t DATA_TYPE_MSK = 0xf8000000; /* Data type bit masks */
-static constexpr uint32_t HEADER = 0x40000000;      /* Global header data type */
-static constexpr uint32_t TRAILER = 0x80000000;     /* Global trailer data type */
-static constexpr uint32_t TDC_MEASURE = 0x00000000; /* TDC measure data type */
-static constexpr uint32_t TDC_MSR_CHANNEL_MSK = 0x03f80000;
-static constexpr uint32_t TDC_MSR_MEASURE_MSK = 0x0007ffff;
-
-static unsigned time(uint32_t data) { return (data & TDC_MSR_MEASURE_MSK);}
-static unsigned chan(uint32_t data) { return (data & TDC_MSR_CHANNEL_MSK) >> 19;}
-static bool isGlobalHeader(uint32_t data) { return (data & DATA_TYPE_MSK) == HEADER;}
-static bool isGlobalTrailer(uint32_t data) {return (data & DATA_TYPE_MSK) == TRAILER;}
-static bool isMeasurement(uint32_t data) {return (data & DATA_TYPE_MSK) == TDC_MEASURE;}
-static Tdc::EdgeDetection edgeDetection(uint32_t data) {
-    if((data >> 26) > 0)
+//Выходной буфер V1190 вмещает 32k слов
+static constexpr size_t outputBufferSize = 32*1024;
+static constexpr uint16_t defaultAlmostFull = 16*1024;
+//Бит BERR_EN регистра управления: BLT завершается ошибкой шины по концу данных
+static constexpr uint16_t berrEnable = 0x1;
+//Интервал опроса eventStored подстраивается под скорость заполнения
+static constexpr microseconds minPollInterval(100);
+static constexpr microseconds maxPollInterval(20000);
+//Пауза между опросами handshake начинается с наблюдаемой задержки микроконтроллера
+static constexpr microseconds maxHandshakePause(1000);
+static constexpr uint16_t hShakeWo = 1;
+static constexpr uint16_t hShakeRo = 2;
+
+static Tdc::EdgeDetection decodeEdgeDetection(uint16_t value) {
+    switch(value) {
+    case 1:
         return Tdc::EdgeDetection::trailing;
-    return Tdc::EdgeDetection::leading;
+    case 2:
+        return Tdc::EdgeDetection::leading;
+    case 3:
+        return Tdc::EdgeDetection::leadingTrailing;
+    default:
+        throw runtime_error("CaenV2718::edgeDetection unknown edgeDetection");
+    }
 }
 
-void decodeEvents(unsigned lsb, const uint32_t* data, size_t size, vector<Tdc::EventHits>& buffer) {
-    buffer.clear();
-    bool header = false;
-    for(size_t i = 0; i < size; ++i) {
-        if(isMeasurement(data[i]) && !buffer.empty() )
-            buffer.back().emplace_back(edgeDetection(data[i]), chan(data[i]), lsb * time(data[i]));
-        else if(isGlobalHeader(data[i]) && !header) {
-            buffer.emplace_back();
-            header = true;
-        } else if(isGlobalTrailer(data[i]) && header)
-            header = false;
+static unsigned decodeLsb(uint16_t value) {
+    switch(value) {
+    case 2:
+        return 98;
+    case 1:
+        return 195;
+    case 0:
+        return 781;
+    default:
+        throw runtime_error("CaenV2718::lsb unknown lsb");
     }
 }
-void decodeHits(unsigned lsb, uint32_t* data, size_t size, vector<Tdc::Hit>& buffer) {
-    buffer.clear();
-    for(size_t i = 0; i < size; ++i)
-        if(isMeasurement(data[i]) )
-            buffer.emplace_back(edgeDetection(data[i]), chan(data[i]), lsb * time(data[i]));
-}
 
-CaenV2718::CaenV2718(unsigned baseAddress)
+CaenV2718::CaenV2718(unsigned baseAddress, short link, short board)
     : mBaseAddress(baseAddress),
-      mIsInit(false) { }
+      mLink(link),
+      mBoard(board),
+      mIsInit(false),
+      mHandshakeDelay(0),
+      mBusCycles(0),
+      mReadBuffer(outputBufferSize),
+      mTriggerMode(true),
+      mAlmostFull(defaultAlmostFull),
+      mWordsPerEvent(16),
+      mIrqLevel(0),
+      mTransferMode(TransferMode::blt32),
+      mCounterSnapshot(0),
+      mCounterValid(false),
+      mTriggerGaps(0),
+      mLostTriggers(0),
+      mCounterMismatches(0),
+      mStreamActive(false),
+      mStreamFailed(false) { }
 
 CaenV2718::~CaenV2718() {
     close();
@@ -98,18 +125,28 @@ CaenV2718::~CaenV2718() {
 
 void CaenV2718::open() {
     if(!mIsInit) {
-        auto status = CAENVME_Init(cvV2718, 0, 0, &mHandle);
+        auto status = CAENVME_Init(cvV2718, mLink, mBoard, &mHandle);
         if(status != cvSuccess)
             throw runtime_error(CAENVME_DecodeError(status));
         mIsInit = true;
         std::this_thread::sleep_for(milliseconds(150));
         updateSettings();
         mCtrl = ctrl();
+        if(!(mCtrl & berrEnable))
+            setCtrl(mCtrl);
+        mTriggerMode = mode() == Mode::trigger;
+        setAlmostFull(mAlmostFull);
+        setInterruptLevel(mIrqLevel);
     }
 }
 
 void CaenV2718::close() {
+    stopStream();
     if(mIsInit) {
+        if(mIrqLevel != 0) {
+            BusLock lk(mMutex);
+            CAENVME_IRQDisable(mHandle, 1u << (mIrqLevel - 1));
+        }
         CAENVME_End(mHandle);
         mIsInit = false;
     }
@@ -119,6 +156,13 @@ bool CaenV2718::isOpen() const {
     return mIsInit;
 }
 
+void CaenV2718::printMeta(std::ostream& stream) const {
+    stream << "Transfer mode:  " << transferMode() << '\n';
+    stream << "Streaming:      " << isStreaming() << '\n';
+    stream << "Almost full:    " << mAlmostFull << '\n';
+    stream << "IRQ level:      " << mIrqLevel << '\n';
+}
+
 CaenV2718::Settings CaenV2718::settings() {
     if(!mIsInit)
         throw std::logic_error("CaenV2718::settings device is not open");
@@ -127,18 +171,124 @@ CaenV2718::Settings CaenV2718::settings() {
 
 void CaenV2718::clear() {
     writeCycle16(Reg::softwareClear, 1);
+    mSequence = CaenDecoder::Sequence();
+    mCounterValid = false;
 }
 
 void CaenV2718::reset() {
     writeCycle16(Reg::softwareReset, 1);
 }
 
-void CaenV2718::readEvents(vector<EventHits>& buffer) {
-    readData(buffer, decodeEvents);
+static int64_t hostTime() {
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void CaenV2718::readEvents(EventBatch& batch) {
+    readRaw(mRaw);
+    decodeRaw(mRaw, batch);
+}
+
+/*
+ * Прочитанные слова копируются в raw, блоки потокового чтения сразу
+ * возвращаются потоку чтения. Снимок eventCounter передается вместе с данными: при декодировании
+ * в другом потоке модуль может быть уже прочитан следующий раз.
+ */
+void CaenV2718::readRaw(RawData& raw) {
+    raw.clear();
+    raw.lsb = mSettings.lsb;
+    if(mStreamActive) {
+        if(mStreamFailed.exchange(false))
+            throw runtime_error("CaenV2718::readStream: failed");
+        BlockPtr block;
+        while(mFilledBlocks.tryPop(block)) {
+            raw.append(block->words.data(), block->words.data() + block->size, block->timestamp);
+            mFreeBlocks.push(std::move(block));
+        }
+        return;
+    }
+    auto readSize = readAvailable(mReadBuffer.data(), mReadBuffer.size());
+    raw.append(mReadBuffer.data(), mReadBuffer.data() + readSize, hostTime());
+    raw.counterValid = mCounterValid.exchange(false);
+    raw.counter = mCounterSnapshot;
+}
+
+void CaenV2718::decodeRaw(RawData& raw, EventBatch& batch) {
+    batch.clear();
+    for(auto& block : raw.blocks)
+        mDecoder.decodeEvents(raw.lsb, raw.words.data() + block.begin, block.end - block.begin,
+                              block.timestamp, mSequence, batch);
+    mTriggerGaps = mSequence.gaps;
+    mLostTriggers = mSequence.lost;
+    if(raw.counterValid)
+        checkEventCounter(raw.counter);
 }
 
 void CaenV2718::readHits(vector<Hit>& buffer) {
-    readData(buffer, decodeHits);
+    readData(buffer, [this](unsigned lsb, const uint32_t* data, size_t size, int64_t, vector<Hit>& hits) {
+        mDecoder.decodeHits(lsb, data, size, hits);
+    });
+}
+
+/*
+ * readPending перед чтением запоминает eventCounter. Все события,
+ * накопленные к этому моменту, вычитаны, поэтому следующий ожидаемый
+ * номер события не может отставать от счетчика.
+ */
+void CaenV2718::checkEventCounter(uint32_t snapshot) {
+    if(!mSequence.valid)
+        return;
+    auto counter = snapshot & CaenDecoder::eventCountMask;
+    auto lag = (counter - mSequence.next) & CaenDecoder::eventCountMask;
+    if(lag != 0 && lag < (CaenDecoder::eventCountMask + 1)/2) {
+        ++mCounterMismatches;
+        std::cerr << "CaenV2718::readEvents event counter " << counter
+                  << " is ahead of decoded events " << mSequence.next << std::endl;
+    }
+}
+
+uintmax_t CaenV2718::triggerGaps() const {
+    return mTriggerGaps;
+}
+
+uintmax_t CaenV2718::lostTriggers() const {
+    return mLostTriggers;
+}
+
+uintmax_t CaenV2718::counterMismatches() const {
+    return mCounterMismatches;
+}
+
+void CaenV2718::startStream(size_t blockSize, size_t blockCount) {
+    if(!mIsInit)
+        throw logic_error("CaenV2718::startStream device is not open");
+    if(mStreamActive)
+        throw logic_error("CaenV2718::startStream stream is active");
+    if(blockSize == 0 || blockCount < 2)
+        throw logic_error("CaenV2718::startStream invalid block configuration");
+    mFreeBlocks.reopen();
+    mFilledBlocks.reopen();
+    for(size_t i = 0; i < blockCount; ++i) {
+        auto block = make_unique<Block>();
+        block->words.resize(blockSize);
+        block->size = 0;
+        mFreeBlocks.push(std::move(block));
+    }
+    mStreamFailed = false;
+    mStreamActive = true;
+    mStreamThread = std::thread(&CaenV2718::streamLoop, this);
+}
+
+void CaenV2718::stopStream() {
+    if(!mStreamActive)
+        return;
+    mStreamActive = false;
+    mStreamThread.join();
+    mFreeBlocks.reopen();
+    mFilledBlocks.reopen();
+}
+
+bool CaenV2718::isStreaming() const {
+    return mStreamActive;
 }
 
 const string& CaenV2718::name() const {
@@ -146,24 +296,35 @@ const string& CaenV2718::name() const {
     return n;
 }
 
-void CaenV2718::updateSettings() {
+CaenV2718::BusStats CaenV2718::updateSettings() {
+    TriggerConf conf;
+    uint16_t detection;
+    uint16_t lsb;
+    auto stats = execute(MicroTransaction()
+            .read(OpCode::getTrigConf, conf.data(), conf.size())
+            .read(OpCode::getDetection, &detection, 1)
+            .read(OpCode::getLSB, &lsb, 1));
     mSettings = {
-        windowWidth(),
-        windowOffset(),
-        edgeDetection(),
-        lsb(),
+        conf.at(0) * 25u,
+        int16_t(conf.at(1)) * 25,
+        decodeEdgeDetection(detection),
+        decodeLsb(lsb),
     };
+    return stats;
 }
 
 void CaenV2718::setMode(Mode mode) {
     switch(mode) {
     case Mode::trigger:
-        return setTriggerMode();
+        setTriggerMode();
+        break;
     case Mode::continuous:
-        return setContinuousMode();
+        setContinuousMode();
+        break;
     default:
         throw logic_error(CAENVME_DecodeError(cvInvalidParam));
     }
+    mTriggerMode = mode == Mode::trigger;
 }
 
 void CaenV2718::setWindowWidth(unsigned width) {
@@ -243,34 +404,13 @@ int CaenV2718::windowOffset() {
 CaenV2718::EdgeDetection CaenV2718::edgeDetection() {
     uint16_t value;
     readMicro(OpCode::getDetection, &value, 1);
-    switch(value) {
-    case 1:
-        return EdgeDetection::trailing;
-    case 2:
-        return EdgeDetection::leading;
-    case 3:
-        return EdgeDetection::leadingTrailing;
-    default:
-        throw runtime_error("CaenV2718::edgeDetection unknown edgeDetection");
-    }
+    return decodeEdgeDetection(value);
 }
 
 unsigned CaenV2718::lsb() {
     uint16_t value;
     readMicro(OpCode::getLSB, &value, 1);
-    switch(value) {
-    case 2:
-        mSettings.lsb = 98;
-        break;
-    case 1:
-        mSettings.lsb = 195;
-        break;
-    case 0:
-        mSettings.lsb = 781;
-        break;
-    default:
-        throw runtime_error("CaenV2718::lsb unknown lsb");
-    }
+    mSettings.lsb = decodeLsb(value);
     return mSettings.lsb;
 }
 
@@ -289,6 +429,7 @@ bool CaenV2718::tdcMeta() {
 }
 
 void CaenV2718::setCtrl(uint16_t ctrl) {
+    ctrl |= berrEnable;
     writeCycle16(Reg::controlReg, ctrl);
     mCtrl = ctrl;
 }
@@ -302,9 +443,98 @@ uint16_t CaenV2718::stat() {
     return readCycle16(Reg::statusReg);
 }
 
+uintmax_t CaenV2718::busCycles() const {
+    return mBusCycles;
+}
+
+uint16_t CaenV2718::eventStored() {
+    return readCycle16(Reg::eventStored);
+}
+
+uint32_t CaenV2718::eventCounter() {
+    return readCycle32(Reg::eventCounter);
+}
+
+void CaenV2718::setAlmostFull(uint16_t words) {
+    if(words < 1 || words > outputBufferSize - 1)
+        throw logic_error(CAENVME_DecodeError(cvInvalidParam));
+    writeCycle16(Reg::almostFull, words);
+    mAlmostFull = words;
+}
+
+uint16_t CaenV2718::almostFull() {
+    mAlmostFull = readCycle16(Reg::almostFull);
+    return mAlmostFull;
+}
+
+void CaenV2718::setInterruptLevel(uint16_t level) {
+    if(level > 7)
+        throw logic_error(CAENVME_DecodeError(cvInvalidParam));
+    uint16_t prevLevel = mIrqLevel;
+    BusLock lk(mMutex);
+    if(prevLevel != 0 && prevLevel != level)
+        CAENVME_IRQDisable(mHandle, 1u << (prevLevel - 1));
+    //Вектор прерывания - младший байт адреса модуля, проверяется в цикле IACK
+    writeCycle16(lk, Reg::interruptVector, irqVector());
+    writeCycle16(lk, Reg::interruptLevel, level);
+    mIrqLevel = level;
+}
+
+uint16_t CaenV2718::interruptLevel() {
+    mIrqLevel = readCycle16(Reg::interruptLevel) & 0x7;
+    return mIrqLevel;
+}
+
+void CaenV2718::setTransferMode(TransferMode mode) {
+    switch(mode) {
+    case TransferMode::blt32:
+    case TransferMode::mblt64:
+    case TransferMode::fifoBlt32:
+    case TransferMode::fifoMblt64:
+        mTransferMode = mode;
+        break;
+    default:
+        throw logic_error(CAENVME_DecodeError(cvInvalidParam));
+    }
+}
+
+CaenV2718::TransferMode CaenV2718::transferMode() const {
+    return mTransferMode;
+}
+
+void CaenV2718::waitEvents(milliseconds timeout) {
+    //Поток чтения сам опрашивает модуль, ждем заполненный блок
+    if(mStreamActive) {
+        mFilledBlocks.wait(timeout);
+        return;
+    }
+    if(!mIsInit || !mTriggerMode)
+        return Tdc::waitEvents(timeout);
+    if(mIrqLevel != 0)
+        return waitInterrupt(timeout);
+    auto deadline = steady_clock::now() + timeout;
+    auto interval = minPollInterval;
+    unsigned prevStored = 0;
+    while(true) {
+        unsigned stored = eventStored();
+        if(stored >= highWaterEvents())
+            return;
+        auto now = steady_clock::now();
+        if(now >= deadline)
+            return;
+        if(stored > prevStored)
+            interval = std::max(minPollInterval, interval / 2);
+        else
+            interval = std::min(maxPollInterval, interval * 2);
+        prevStored = stored;
+        std::this_thread::sleep_for(std::min<steady_clock::duration>(interval, deadline - now));
+    }
+}
+
 void CaenV2718::setTriggerMode() {
-    writeMicro(OpCode::setTrigMode, nullptr, 0);
-    writeMicro(OpCode::enableTrigSub, nullptr, 0);
+    execute(MicroTransaction()
+            .write(OpCode::setTrigMode)
+            .write(OpCode::enableTrigSub));
 }
 
 void CaenV2718::setContinuousMode() {
@@ -312,76 +542,263 @@ void CaenV2718::setContinuousMode() {
 }
 
 template<typename B, typename D>
-void CaenV2718::readData(B& buffer, D& decode) {
-    static uint32_t buf[1024];
-    int readBytes;
-    auto errCode = CAENVME_BLTReadCycle(mHandle, formAddress(Reg::outputBuffer), buf, sizeof(buf), cvA32_U_BLT, cvD32, &readBytes);
-    if((errCode == cvBusError && (mCtrl & 1)) || errCode == cvSuccess) {
-        size_t readSize = size_t(readBytes / sizeof(uint32_t));
-        decode(mSettings.lsb, buf, readSize, buffer);
-    } else {
-        buffer.clear();
+void CaenV2718::readData(B& buffer, const D& decode) {
+    buffer.clear();
+    if(mStreamActive)
+        return readStream(buffer, decode);
+    auto readSize = readAvailable(mReadBuffer.data(), mReadBuffer.size());
+    decode(mSettings.lsb, mReadBuffer.data(), readSize, hostTime(), buffer);
+}
+
+template<typename B, typename D>
+void CaenV2718::readStream(B& buffer, const D& decode) {
+    if(mStreamFailed.exchange(false))
+        throw runtime_error("CaenV2718::readStream: failed");
+    BlockPtr block;
+    //Пока декодируется блок, поток чтения заполняет следующий
+    while(mFilledBlocks.tryPop(block)) {
+        decode(mSettings.lsb, block->words.data(), block->size, block->timestamp, buffer);
+        mFreeBlocks.push(std::move(block));
+    }
+}
+
+static CVErrorCodes bltRead(int32_t handle, uint32_t address, uint32_t* data, size_t size, CaenV2718::TransferMode mode, int& readBytes) {
+    auto bytes = int(size*sizeof(uint32_t));
+    switch(mode) {
+    case CaenV2718::TransferMode::mblt64:
+        return CAENVME_MBLTReadCycle(handle, address, data, bytes, cvA32_U_MBLT, &readBytes);
+    case CaenV2718::TransferMode::fifoBlt32:
+        return CAENVME_FIFOBLTReadCycle(handle, address, data, bytes, cvA32_U_BLT, cvD32, &readBytes);
+    case CaenV2718::TransferMode::fifoMblt64:
+        return CAENVME_FIFOMBLTReadCycle(handle, address, data, bytes, cvA32_U_MBLT, &readBytes);
+    default:
+        return CAENVME_BLTReadCycle(handle, address, data, bytes, cvA32_U_BLT, cvD32, &readBytes);
+    }
+}
+
+static bool is64Bit(CaenV2718::TransferMode mode) {
+    return mode == CaenV2718::TransferMode::mblt64 || mode == CaenV2718::TransferMode::fifoMblt64;
+}
+
+/*
+ * В режимах MBLT модуль передает 64-битные слова: запрос округляется
+ * до четного числа 32-битных слов, а нечетный хвост дополняется
+ * модулем словом-заполнителем, которое декодер пропускает.
+ */
+size_t CaenV2718::readBlock(BusLock& lock, uint32_t* data, size_t size) {
+    assert(lock.owns_lock());
+    auto mode = mTransferMode.load();
+    if(is64Bit(mode))
+        size &= ~size_t(1);
+    int readBytes = 0;
+    ++mBusCycles;
+    auto errCode = bltRead(mHandle, formAddress(Reg::outputBuffer), data, size, mode, readBytes);
+    if(mode != TransferMode::blt32 && readBytes == 0 &&
+       (errCode == cvInvalidParam || errCode == cvGenericError || errCode == cvCommError)) {
+        std::cerr << "CaenV2718::read " << mode << " rejected: " << CAENVME_DecodeError(errCode)
+                  << ", falling back to " << TransferMode::blt32 << std::endl;
+        mTransferMode = TransferMode::blt32;
+        return readBlock(lock, data, size);
+    }
+    if(!((errCode == cvBusError && (mCtrl & berrEnable)) || errCode == cvSuccess))
         throw runtime_error("CaenV2718::read: failed");
+    return size_t(readBytes) / sizeof(uint32_t);
+}
+
+/*
+ * Все вызовы CAENVME, кроме IRQWait, выполняются под mMutex. IRQWait
+ * только ждет линию и идет без захвата, чтобы не блокировать обращения
+ * к регистрам на время ожидания. По истечении timeout возвращаемся,
+ * и неполный буфер вычитывается как при опросе.
+ */
+void CaenV2718::waitInterrupt(milliseconds timeout) {
+    auto level = mIrqLevel.load();
+    auto mask = 1u << (level - 1);
+    {
+        BusLock lk(mMutex);
+        auto status = CAENVME_IRQEnable(mHandle, mask);
+        if(status != cvSuccess)
+            throw runtime_error(CAENVME_DecodeError(status));
+    }
+    ++mBusCycles;
+    auto status = CAENVME_IRQWait(mHandle, mask, uint32_t(timeout.count()));
+    if(status == cvTimeoutError)
+        return;
+    if(status != cvSuccess)
+        throw runtime_error(CAENVME_DecodeError(status));
+    uint16_t vector;
+    BusLock lk(mMutex);
+    ++mBusCycles;
+    status = CAENVME_IACKCycle(mHandle, CVIRQLevels(mask), &vector, cvD16);
+    if(status != cvSuccess)
+        throw runtime_error(CAENVME_DecodeError(status));
+    //Линию выставил другой модуль того же уровня, буфер все равно проверяется
+    if((vector & 0xFF) != irqVector())
+        std::cerr << "CaenV2718::waitInterrupt foreign IRQ vector " << (vector & 0xFF) << std::endl;
+}
+
+uint16_t CaenV2718::irqVector() const {
+    return uint16_t(mBaseAddress & 0xFF);
+}
+
+size_t CaenV2718::readAvailable(uint32_t* data, size_t capacity) {
+    if(mTriggerMode)
+        return readPending(data, capacity);
+    BusLock lk(mMutex);
+    return readBlock(lk, data, capacity);
+}
+
+/*
+ * Опрос eventStored и вся серия BLT выполняются под одним захватом шины.
+ */
+size_t CaenV2718::readPending(uint32_t* data, size_t capacity) {
+    BusLock lk(mMutex);
+    unsigned stored = readCycle16(lk, Reg::eventStored);
+    if(stored == 0)
+        return 0;
+    //Счетчик читается только в основном потоке, при потоковом чтении сверка не выполняется
+    if(!mStreamActive) {
+        mCounterSnapshot = readCycle32(lk, Reg::eventCounter);
+        mCounterValid = true;
+    }
+    /*
+     * Размер BLT оценивается по числу накопленных событий, при заполнении блока
+     * целиком дочитываем. Конец данных определяется по BERR (он всегда включен),
+     * поэтому лишних слов-заполнителей не читается.
+     */
+    auto estimate = size_t(stored * mWordsPerEvent * 1.5) + 64;
+    auto chunk = std::min(capacity, (estimate + 63) / 64 * 64);
+    size_t total = 0;
+    while(total < capacity) {
+        auto request = std::min(chunk, capacity - total);
+        auto readSize = readBlock(lk, data + total, request);
+        total += readSize;
+        if(readSize < request)
+            break;
+    }
+    mWordsPerEvent = 0.8 * mWordsPerEvent + 0.2 * double(total) / stored;
+    return total;
+}
+
+unsigned CaenV2718::highWaterEvents() const {
+    return std::max(1u, unsigned(mAlmostFull / mWordsPerEvent));
+}
+
+void CaenV2718::streamLoop() {
+    BlockPtr block;
+    while(mStreamActive) {
+        if(!block && !mFreeBlocks.pop(block, milliseconds(100)))
+            continue;
+        try {
+            block->size = readAvailable(block->words.data(), block->words.size());
+            block->timestamp = hostTime();
+        } catch(std::exception& e) {
+            std::cerr << "CaenV2718::streamLoop " << e.what() << std::endl;
+            mStreamFailed = true;
+            std::this_thread::sleep_for(milliseconds(100));
+            continue;
+        }
+        if(block->size == 0) {
+            std::this_thread::sleep_for(milliseconds(1));
+            continue;
+        }
+        mFilledBlocks.push(std::move(block));
     }
 }
 
 uint16_t CaenV2718::readCycle16(Reg addr) {
+    BusLock lk(mMutex);
+    return readCycle16(lk, addr);
+}
+
+void CaenV2718::writeCycle16(Reg addr, uint16_t word) {
+    BusLock lk(mMutex);
+    writeCycle16(lk, addr, word);
+}
+
+uint32_t CaenV2718::readCycle32(Reg addr) {
+    BusLock lk(mMutex);
+    return readCycle32(lk, addr);
+}
+
+void CaenV2718::writeCycle32(Reg addr, uint32_t word) {
+    BusLock lk(mMutex);
+    writeCycle32(lk, addr, word);
+}
+
+uint16_t CaenV2718::readCycle16(BusLock& lock, Reg addr) {
+    assert(lock.owns_lock());
     uint16_t word;
-    Lock lk(mMutex);
+    ++mBusCycles;
     auto errCode = CAENVME_ReadCycle(mHandle, formAddress(addr), reinterpret_cast<void*>(&word), cvA32_S_DATA, cvD16 );
     if(errCode != cvSuccess)
         throw runtime_error(CAENVME_DecodeError(errCode));
     return word;
 }
-void CaenV2718::writeCycle16(Reg addr, uint16_t word) {
-    Lock lk(mMutex);
+void CaenV2718::writeCycle16(BusLock& lock, Reg addr, uint16_t word) {
+    assert(lock.owns_lock());
+    ++mBusCycles;
     auto errCode = CAENVME_WriteCycle(mHandle, formAddress(addr), reinterpret_cast<void*>(&word), cvA32_S_DATA, cvD16);
     if(errCode != cvSuccess)
         throw runtime_error(CAENVME_DecodeError(errCode));
 }
 
-uint32_t CaenV2718::readCycle32(Reg addr) {
-    uint16_t word;
-    Lock lk(mMutex);
+uint32_t CaenV2718::readCycle32(BusLock& lock, Reg addr) {
+    assert(lock.owns_lock());
+    uint32_t word;
+    ++mBusCycles;
     auto errCode = CAENVME_ReadCycle(mHandle, formAddress(addr), reinterpret_cast<void*>(&word), cvA32_S_DATA, cvD32);
     if(errCode != cvSuccess)
         throw runtime_error(CAENVME_DecodeError(errCode));
     return word;
 }
-void CaenV2718::writeCycle32(Reg addr, uint32_t word) {
-    Lock lk(mMutex);
+void CaenV2718::writeCycle32(BusLock& lock, Reg addr, uint32_t word) {
+    assert(lock.owns_lock());
+    ++mBusCycles;
     auto errCode = CAENVME_WriteCycle(mHandle, formAddress(addr), reinterpret_cast<void*>(&word), cvA32_S_DATA, cvD32);
     if(errCode != cvSuccess)
         throw runtime_error(CAENVME_DecodeError(errCode));
 }
 
 void CaenV2718::writeMicro(OpCode code, const uint16_t* data, size_t size) {
-    Lock lk(mMicroMutex);
-    checkMicroWrite();
-    //Указываем opCode
-    writeCycle16(Reg::micro, uint16_t(code));
-    if(size == 0)
-        return;
-    do {
-        //Проверяем handshake
-        checkMicroWrite();
-        writeCycle16(Reg::micro, *data);
-        ++data;
-    } while(--size);
+    execute(MicroTransaction().write(code, data, size));
 }
 
 void CaenV2718::readMicro(OpCode code, uint16_t* data, size_t size) {
-    Lock lk(mMicroMutex);
-    checkMicroWrite();
-    //Указываем opCode
-    writeCycle16(Reg::micro, uint16_t(code));
-    if(size == 0)
-        return;
-    do {
-        checkMicroRead();
-        *data = readCycle16(Reg::micro);
-        ++data;
-    } while(--size);
+    execute(MicroTransaction().read(code, data, size));
+}
+
+/*
+ * Каждое слово микроконтроллера требует проверки handshake, поэтому
+ * слова одной команды нельзя объединить в MultiRead/MultiWrite.
+ * Транзакция выполняется целиком под mMicroMutex и не перемежается
+ * командами других потоков. Шина захватывается один раз на транзакцию
+ * и отпускается только на паузы ожидания handshake, чтобы в них могли
+ * пройти обращения к регистрам из других потоков. Поэтому циклы
+ * транзакции считаются здесь, а не по общему счетчику mBusCycles.
+ */
+CaenV2718::BusStats CaenV2718::execute(const MicroTransaction& transaction) {
+    Lock micro(mMicroMutex);
+    BusLock lk(mMutex);
+    auto start = steady_clock::now();
+    uintmax_t cycles = 0;
+    for(auto& op : transaction.mOps) {
+        cycles += waitHandshake(lk, hShakeWo);
+        //Указываем opCode
+        writeCycle16(lk, Reg::micro, uint16_t(op.code));
+        ++cycles;
+        for(size_t i = 0; i < op.inputSize; ++i) {
+            cycles += waitHandshake(lk, hShakeWo);
+            writeCycle16(lk, Reg::micro, op.input[i]);
+            ++cycles;
+        }
+        for(size_t i = 0; i < op.outputSize; ++i) {
+            cycles += waitHandshake(lk, hShakeRo);
+            op.output[i] = readCycle16(lk, Reg::micro);
+            ++cycles;
+        }
+    }
+    return {cycles, duration_cast<microseconds>(steady_clock::now() - start)};
 }
 
 CaenV2718::TriggerConf CaenV2718::getTriggerConf() {
@@ -390,32 +807,44 @@ CaenV2718::TriggerConf CaenV2718::getTriggerConf() {
     return conf;
 }
 
-void CaenV2718::checkMicroWrite() {
-    static constexpr uint16_t hShakeWo = 1;
-
-    seconds timeout(2);
-    auto s = system_clock::now();
-    while(system_clock::now() - s < timeout) {
-        auto hShake = readCycle16(Reg::handshake);
-        if(hShake & hShakeWo)
-            return;
-    }
-    throw runtime_error(CAENVME_DecodeError(cvTimeoutError));
-}
-
-void CaenV2718::checkMicroRead() {
-    static constexpr uint16_t hShakeRo = 2;
-
-    seconds timeout(2);
-    auto s = system_clock::now();
-    while(system_clock::now() - s < timeout) {
-        auto hShake = readCycle16(Reg::handshake);
-        if(hShake & hShakeRo)
-            return;
+unsigned CaenV2718::waitHandshake(BusLock& lock, uint16_t mask) {
+    static constexpr seconds timeout(2);
+    auto start = steady_clock::now();
+    auto pause = mHandshakeDelay / 2;
+    unsigned polls = 0;
+    while(true) {
+        ++polls;
+        if(readCycle16(lock, Reg::handshake) & mask) {
+            auto elapsed = duration_cast<microseconds>(steady_clock::now() - start);
+            mHandshakeDelay = (3 * mHandshakeDelay + elapsed) / 4;
+            return polls;
+        }
+        if(steady_clock::now() - start > timeout)
+            throw runtime_error(CAENVME_DecodeError(cvTimeoutError));
+        lock.unlock();
+        if(pause.count() == 0)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(pause);
+        lock.lock();
+        pause = std::min(maxHandshakePause, std::max(microseconds(1), pause * 2));
     }
-    throw runtime_error(CAENVME_DecodeError(cvTimeoutError));
 }
 
 uint32_t CaenV2718::formAddress(Reg addr) const {
     return ((uint32_t(mBaseAddress)) << 16) | uint16_t(addr);
 }
+
+std::ostream& operator<<(std::ostream& stream, CaenV2718::TransferMode mode) {
+    switch(mode) {
+    case CaenV2718::TransferMode::blt32:
+        return stream << "blt32";
+    case CaenV2718::TransferMode::mblt64:
+        return stream << "mblt64";
+    case CaenV2718::TransferMode::fifoBlt32:
+        return stream << "fifo_blt32";
+    case CaenV2718::TransferMode::fifoMblt64:
+        return stream << "fifo_mblt64";
+    }
+    return stream;
+}
@@ -1,7 +1,12 @@
 #pragma once
 
 #include "tdc.hpp"
+#include "caendecoder.hpp"
+#include "blockingqueue.hpp"
 
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <array>
 #include <mutex>
 
@@ -10,24 +15,80 @@ class CaenV2718 : public Tdc {
     enum class OpCode : uint16_t;
     using Mutex = std::mutex;
     using Lock = std::lock_guard<Mutex>;
+    // Захваченная шина; функции, принимающие BusLock, не блокируют mMutex сами
+    using BusLock = std::unique_lock<Mutex>;
     using TriggerConf = std::array<uint16_t, 5>;
+    struct Block {
+        std::vector<uint32_t> words;
+        size_t size;
+        int64_t timestamp;
+    };
+    using BlockPtr = std::unique_ptr<Block>;
+    // Последовательность команд микроконтроллера, выполняемая под одной блокировкой
+    class MicroTransaction {
+        friend class CaenV2718;
+        struct Op {
+            OpCode code;
+            const uint16_t* input;
+            size_t inputSize;
+            uint16_t* output;
+            size_t outputSize;
+        };
+    public:
+        MicroTransaction& write(OpCode code, const uint16_t* data = nullptr, size_t size = 0) {
+            mOps.push_back({code, data, size, nullptr, 0});
+            return *this;
+        }
+        MicroTransaction& read(OpCode code, uint16_t* data, size_t size) {
+            mOps.push_back({code, nullptr, 0, data, size});
+            return *this;
+        }
+    private:
+        std::vector<Op> mOps;
+    };
 public:
-    CaenV2718(unsigned vmeAddress);
+    enum class TransferMode {
+        blt32      = 0,
+        mblt64     = 1,
+        fifoBlt32  = 2,
+        fifoMblt64 = 3,
+    };
+    // Циклы VME и длительность одной транзакции микроконтроллера
+    struct BusStats {
+        uintmax_t cycles;
+        std::chrono::microseconds time;
+    };
+public:
+    // link и board - номер оптической линии A2818 и позиция V2718 в цепочке
+    CaenV2718(unsigned vmeAddress, short link = 0, short board = 0);
     ~CaenV2718();
 
-    void readEvents(std::vector<EventHits>& buffer) override;
+    void readEvents(EventBatch& batch) override;
     void readHits(std::vector<Hit>& buffer) override;
+    void readRaw(RawData& raw) override;
+    void decodeRaw(RawData& raw, EventBatch& batch) override;
+    void waitEvents(std::chrono::milliseconds timeout) override;
     const std::string& name() const override;
+    void printMeta(std::ostream& stream) const override;
     Settings settings() override;
     bool isOpen() const override;
     void clear() override;
 
     void open();
     void close();
-    void updateSettings();
+    BusStats updateSettings();
 
     void reset();
 
+    short link() const { return mLink; }
+    short board() const { return mBoard; }
+    unsigned baseAddress() const { return mBaseAddress; }
+
+    // Непрерывное чтение BLT в отдельном потоке, размер блока в словах
+    void startStream(size_t blockSize = 1024*1024, size_t blockCount = 4);
+    void stopStream();
+    bool isStreaming() const;
+
     Mode mode() override;
     void setMode(Mode mode) override;
 
@@ -46,13 +107,49 @@ public:
     void setTdcMeta(bool flag);
     bool tdcMeta();
 
+    // Бит BERR_EN (0) устанавливается всегда: по нему чтение находит конец данных
     void setCtrl(uint16_t ctrl);
     uint16_t ctrl();
 
     uint16_t stat();
+
+    // Число циклов VME с момента создания по всем потокам
+    uintmax_t busCycles() const;
+
+    uint16_t eventStored();
+    uint32_t eventCounter();
+
+    // Пропуски в номерах событий глобальных заголовков и расхождения с eventCounter
+    uintmax_t triggerGaps() const;
+    uintmax_t lostTriggers() const;
+    uintmax_t counterMismatches() const;
+
+    // Порог заполнения выходного буфера в словах, по нему планируется чтение
+    void setAlmostFull(uint16_t words);
+    uint16_t almostFull();
+
+    // Уровень прерывания VME (0 - выключено). Модуль выставляет IRQ,
+    // когда заполнение выходного буфера достигает almostFull; вектор
+    // прерывания - младший байт адреса модуля
+    void setInterruptLevel(uint16_t level);
+    uint16_t interruptLevel();
+
+    // Режим блочной передачи; если модуль его не принимает, чтение переходит на BLT32
+    void setTransferMode(TransferMode mode);
+    TransferMode transferMode() const;
 protected:
     template<typename B, typename D>
-    void readData(B& buffer, D& decoder);
+    void readData(B& buffer, const D& decode);
+    template<typename B, typename D>
+    void readStream(B& buffer, const D& decode);
+    size_t readBlock(BusLock& lock, uint32_t* data, size_t size);
+    size_t readPending(uint32_t* data, size_t capacity);
+    size_t readAvailable(uint32_t* data, size_t capacity);
+    unsigned highWaterEvents() const;
+    void checkEventCounter(uint32_t snapshot);
+    void waitInterrupt(std::chrono::milliseconds timeout);
+    uint16_t irqVector() const;
+    void streamLoop();
     void setTriggerMode();
     void setContinuousMode();
 
@@ -62,21 +159,56 @@ protected:
     uint32_t readCycle32(Reg addr);
     void writeCycle32(Reg addr, uint32_t);
 
+    uint16_t readCycle16(BusLock& lock, Reg addr);
+    void writeCycle16(BusLock& lock, Reg addr, uint16_t word);
+
+    uint32_t readCycle32(BusLock& lock, Reg addr);
+    void writeCycle32(BusLock& lock, Reg addr, uint32_t);
+
     void writeMicro(OpCode code, const uint16_t* data, size_t size);
     void readMicro(OpCode code, uint16_t* data, size_t size);
+    BusStats execute(const MicroTransaction& transaction);
 
-    void checkMicroWrite();
-    void checkMicroRead();
+    // Возвращает число прочитанных слов handshake
+    unsigned waitHandshake(BusLock& lock, uint16_t mask);
 
     TriggerConf getTriggerConf();
     inline uint32_t formAddress(Reg addr) const;
 private:
     int32_t mHandle;
     uint32_t mBaseAddress;
+    short mLink;
+    short mBoard;
     bool mIsInit;
     Mutex mMutex;
     Mutex mMicroMutex;
+    std::chrono::microseconds mHandshakeDelay;
+    std::atomic<uintmax_t> mBusCycles;
+    CaenDecoder mDecoder;
+    std::vector<uint32_t> mReadBuffer;
+    RawData mRaw;
+
+    std::atomic_bool mTriggerMode;
+    std::atomic<uint16_t> mAlmostFull;
+    std::atomic<double> mWordsPerEvent;
+    std::atomic<uint16_t> mIrqLevel;
+    std::atomic<TransferMode> mTransferMode;
+
+    CaenDecoder::Sequence mSequence;
+    std::atomic<uint32_t> mCounterSnapshot;
+    std::atomic_bool mCounterValid;
+    std::atomic<uintmax_t> mTriggerGaps;
+    std::atomic<uintmax_t> mLostTriggers;
+    std::atomic<uintmax_t> mCounterMismatches;
+
+    std::thread mStreamThread;
+    std::atomic_bool mStreamActive;
+    std::atomic_bool mStreamFailed;
+    BlockingQueue<BlockPtr> mFreeBlocks;
+    BlockingQueue<BlockPtr> mFilledBlocks;
 
     mutable Settings mSettings;
     mutable uint16_t mCtrl;
 };
+
+std::ostream& operator<<(std::ostream& stream, CaenV2718::TransferMode mode);
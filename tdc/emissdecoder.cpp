@@ -0,0 +1,361 @@
+#include "emissdecoder.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EMISS_DECODER_X86
+#include <immintrin.h>
+#endif
+
+using std::vector;
+using std::logic_error;
+
+static constexpr uint32_t EVENT_MARKER = 0xFFFFFFFF;
+static constexpr size_t   EVENT_HEADER = 5;          /* Marker and header words skipped before hits */
+static constexpr uint32_t HIT_FLAG     = 0x00008000; /* Set for non-measurement words */
+static constexpr uint32_t CHANNEL_MSK  = 0x1F;
+static constexpr uint32_t CHANNEL_SHIFT = 10;
+static constexpr uint32_t MODULE_MSK   = 0x3F;
+static constexpr uint32_t MODULE_SHIFT = 16;
+static constexpr uint32_t TIME_MSK     = 0x3FF;
+static constexpr uint32_t TRIGGER_MSK  = 0xFFFF;
+static constexpr uint8_t  LEADING      = 0;
+
+/*
+ * Канал модуля сдвигается на 64*module: исходный декодер добавлял
+ * 32*module дважды, номера каналов в channels.conf на это рассчитаны.
+ */
+static uint32_t channel(uint32_t word) {
+    return ((word >> CHANNEL_SHIFT) & CHANNEL_MSK) + (((word >> MODULE_SHIFT) & MODULE_MSK) << 6);
+}
+static uint32_t time(uint32_t word) { return (word & TIME_MSK) << 3; }
+static bool isHit(uint32_t word) { return (word & HIT_FLAG) == 0; }
+
+static void findMarkersScalar(const uint32_t* data, size_t begin, size_t size, vector<size_t>& markers) {
+    for(size_t i = begin; i < size; ++i)
+        if(data[i] == EVENT_MARKER)
+            markers.push_back(i);
+}
+
+template<typename Emit, typename Special>
+static void decodePayloadScalar(const uint32_t* data, size_t size, Emit& emit, Special& special) {
+    for(size_t i = 0; i < size; ++i) {
+        if(isHit(data[i]))
+            emit(channel(data[i]), time(data[i]));
+        else
+            special(data[i]);
+    }
+}
+
+static size_t countPayload(const uint32_t* data, size_t size) {
+    size_t count = 0;
+    for(size_t i = 0; i < size; ++i)
+        count += isHit(data[i]);
+    return count;
+}
+
+#ifdef EMISS_DECODER_X86
+
+static void emitMarkers(size_t base, unsigned mask, vector<size_t>& markers) {
+    while(mask != 0) {
+        markers.push_back(base + unsigned(__builtin_ctz(mask)));
+        mask &= mask - 1;
+    }
+}
+
+template<typename Emit>
+static void emitHits(const uint32_t* chans, const uint32_t* times, unsigned mask, Emit& emit) {
+    while(mask != 0) {
+        auto j = unsigned(__builtin_ctz(mask));
+        mask &= mask - 1;
+        emit(chans[j], times[j]);
+    }
+}
+
+//Специальные слова редки, маска обычно пуста
+template<typename Special>
+static void emitSpecials(const uint32_t* words, unsigned mask, Special& special) {
+    while(mask != 0) {
+        auto j = unsigned(__builtin_ctz(mask));
+        mask &= mask - 1;
+        special(words[j]);
+    }
+}
+
+__attribute__((target("sse2")))
+static void findMarkersSse2(const uint32_t* data, size_t size, vector<size_t>& markers) {
+    const auto marker = _mm_set1_epi32(int(EVENT_MARKER));
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        auto mask = unsigned(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, marker))));
+        emitMarkers(i, mask, markers);
+    }
+    findMarkersScalar(data, i, size, markers);
+}
+
+template<typename Emit, typename Special>
+__attribute__((target("sse2")))
+static void decodePayloadSse2(const uint32_t* data, size_t size, Emit& emit, Special& special) {
+    const auto hitFlag = _mm_set1_epi32(int(HIT_FLAG));
+    const auto chanMsk = _mm_set1_epi32(int(CHANNEL_MSK));
+    const auto modMsk  = _mm_set1_epi32(int(MODULE_MSK));
+    const auto timeMsk = _mm_set1_epi32(int(TIME_MSK));
+    alignas(16) uint32_t chans[4], times[4];
+
+    size_t i = 0;
+    for(; i + 4 <= size; i += 4) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        auto hit = _mm_cmpeq_epi32(_mm_and_si128(v, hitFlag), _mm_setzero_si128());
+        auto mask = unsigned(_mm_movemask_ps(_mm_castsi128_ps(hit)));
+        if(mask != 0xF)
+            emitSpecials(data + i, ~mask & 0xF, special);
+        if(mask == 0)
+            continue;
+        auto chan = _mm_and_si128(_mm_srli_epi32(v, CHANNEL_SHIFT), chanMsk);
+        auto mod  = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v, MODULE_SHIFT), modMsk), 6);
+        _mm_store_si128(reinterpret_cast<__m128i*>(chans), _mm_add_epi32(chan, mod));
+        _mm_store_si128(reinterpret_cast<__m128i*>(times), _mm_slli_epi32(_mm_and_si128(v, timeMsk), 3));
+        emitHits(chans, times, mask, emit);
+    }
+    decodePayloadScalar(data + i, size - i, emit, special);
+}
+
+__attribute__((target("avx2")))
+static void findMarkersAvx2(const uint32_t* data, size_t size, vector<size_t>& markers) {
+    const auto marker = _mm256_set1_epi32(int(EVENT_MARKER));
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        auto mask = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, marker))));
+        emitMarkers(i, mask, markers);
+    }
+    findMarkersScalar(data, i, size, markers);
+}
+
+template<typename Emit, typename Special>
+__attribute__((target("avx2")))
+static void decodePayloadAvx2(const uint32_t* data, size_t size, Emit& emit, Special& special) {
+    const auto hitFlag = _mm256_set1_epi32(int(HIT_FLAG));
+    const auto chanMsk = _mm256_set1_epi32(int(CHANNEL_MSK));
+    const auto modMsk  = _mm256_set1_epi32(int(MODULE_MSK));
+    const auto timeMsk = _mm256_set1_epi32(int(TIME_MSK));
+    alignas(32) uint32_t chans[8], times[8];
+
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        auto hit = _mm256_cmpeq_epi32(_mm256_and_si256(v, hitFlag), _mm256_setzero_si256());
+        auto mask = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(hit)));
+        if(mask != 0xFF)
+            emitSpecials(data + i, ~mask & 0xFF, special);
+        if(mask == 0)
+            continue;
+        auto chan = _mm256_and_si256(_mm256_srli_epi32(v, CHANNEL_SHIFT), chanMsk);
+        auto mod  = _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(v, MODULE_SHIFT), modMsk), 6);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(chans), _mm256_add_epi32(chan, mod));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(times), _mm256_slli_epi32(_mm256_and_si256(v, timeMsk), 3));
+        emitHits(chans, times, mask, emit);
+    }
+    decodePayloadScalar(data + i, size - i, emit, special);
+}
+
+#endif
+
+//Меньшие буферы декодируются в одном потоке
+static constexpr size_t parallelThreshold = 256*1024;
+
+EmissDecoder::EmissDecoder(Isa isa)
+    : mIsa(isa),
+      mThreads(1),
+      mTriggerWord(-1),
+      mResetStats(false),
+      mLatchedWord(-1),
+      mTriggerValid(false),
+      mNextTrigger(0) {
+    if(int(isa) > int(supportedSimdIsa()))
+        throw logic_error("EmissDecoder::EmissDecoder isa is not supported");
+}
+
+void EmissDecoder::setThreads(unsigned threads) {
+    if(threads == 0)
+        throw logic_error("EmissDecoder::setThreads invalid thread count");
+    mThreads = threads;
+}
+
+void EmissDecoder::setTriggerWord(int index) {
+    if(index < -1 || index >= int(EVENT_HEADER - 1))
+        throw logic_error("EmissDecoder::setTriggerWord invalid index");
+    mTriggerWord = index;
+}
+
+void EmissDecoder::resetStats() {
+    mResetStats = true;
+}
+
+void EmissDecoder::decodeEvents(const uint32_t* data,
+                                size_t size,
+                                int64_t timestamp,
+                                uint32_t& eventNumber,
+                                EventBatch& batch) {
+    findMarkers(data, size);
+    if(mMarkers.empty())
+        return;
+    findEvents(data, size, eventNumber);
+    //Число потоков фиксируется на весь вызов
+    auto threads = mThreads.load();
+    if(threads > 1 && size >= parallelThreshold && mEvents.size() >= threads)
+        return decodeParallel(data, threads, timestamp, batch);
+    batch.reserveAppend(mEvents.size(), size - mMarkers.front());
+    auto emit = [&batch](uint32_t channel, uint32_t time) { batch.addHit(channel, time, LEADING); };
+    auto special = [&batch](uint32_t word) { batch.addSpecial(word); };
+    for(auto& e : mEvents) {
+        batch.beginEvent(e.trigger, timestamp, e.header);
+        auto event = batch.eventCount() - 1;
+        decodePayload(data + e.begin, e.end - e.begin, emit, special);
+        //Все слова события, кроме хитов, - специальные (0b10, 0b11)
+        batch.header(event).special = uint32_t(e.end - e.begin - batch.eventSize(event));
+    }
+}
+
+void EmissDecoder::decodeHits(const uint32_t* data, size_t size, size_t& headerSkip, vector<Tdc::Hit>& hits) {
+    findMarkers(data, size);
+    auto emit = [&hits](uint32_t channel, uint32_t time) { hits.emplace_back(Tdc::EdgeDetection::leading, channel, time); };
+    auto skip = [](uint32_t) { };
+    auto pos = std::min(headerSkip, size);
+    headerSkip -= pos;
+    for(auto m : mMarkers) {
+        if(m < pos)
+            continue;
+        decodePayload(data + pos, m - pos, emit, skip);
+        pos = m + EVENT_HEADER;
+        if(pos > size) {
+            headerSkip = pos - size;
+            pos = size;
+        }
+    }
+    decodePayload(data + pos, size - pos, emit, skip);
+}
+
+/*
+ * Маркер внутри заголовка предыдущего события пропускается,
+ * хиты события - слова от конца заголовка до следующего маркера.
+ * Заголовок и проверка номеров триггеров разбираются в этом же проходе.
+ */
+void EmissDecoder::findEvents(const uint32_t* data, size_t size, uint32_t& eventNumber) {
+    mEvents.clear();
+    //Настройки из других потоков применяются между вызовами
+    if(mResetStats.exchange(false)) {
+        mStats = Stats();
+        mTriggerValid = false;
+    }
+    auto triggerWord = mTriggerWord.load();
+    if(triggerWord != mLatchedWord) {
+        mLatchedWord = triggerWord;
+        mTriggerValid = false;
+    }
+    size_t k = 0;
+    while(k < mMarkers.size()) {
+        auto marker = mMarkers[k];
+        auto begin = marker + EVENT_HEADER;
+        Event e{0, 0, eventNumber++, EventHeader()};
+        while(++k < mMarkers.size() && mMarkers[k] < begin)
+            e.header.flags |= EventHeader::truncated;
+        auto end = k < mMarkers.size() ? mMarkers[k] : size;
+        if(begin > end)
+            e.header.flags |= EventHeader::truncated;
+        for(size_t j = 0; j < e.header.words.size() && marker + 1 + j < size; ++j)
+            e.header.words[j] = data[marker + 1 + j];
+        e.begin = std::min(begin, end);
+        e.end = end;
+
+        ++mStats.events;
+        if(e.header.flags & EventHeader::truncated) {
+            ++mStats.truncated;
+            if(triggerWord >= 0)
+                e.trigger = mNextTrigger;
+        } else if(triggerWord >= 0) {
+            e.trigger = e.header.words[triggerWord] & TRIGGER_MSK;
+            if(mTriggerValid && e.trigger != mNextTrigger) {
+                ++mStats.gaps;
+                mStats.lost += (e.trigger - mNextTrigger) & TRIGGER_MSK;
+            }
+            mTriggerValid = true;
+        }
+        mNextTrigger = (e.trigger + 1) & TRIGGER_MSK;
+        mEvents.push_back(e);
+    }
+}
+
+void EmissDecoder::decodeParallel(const uint32_t* data, unsigned threads, int64_t timestamp, EventBatch& batch) {
+    //События делятся на куски примерно равного числа слов
+    auto words = mEvents.back().end - mEvents.front().begin;
+    mChunks.assign(1, 0);
+    size_t acc = 0;
+    for(size_t e = 0; e < mEvents.size(); ++e) {
+        acc += mEvents[e].end - mEvents[e].begin;
+        if(acc * threads >= words * mChunks.size() && mChunks.size() < threads)
+            mChunks.push_back(e + 1);
+    }
+    if(mChunks.back() != mEvents.size())
+        mChunks.push_back(mEvents.size());
+    auto chunks = mChunks.size() - 1;
+
+    //Все слова события, кроме хитов, - специальные
+    mCounts.resize(mEvents.size());
+    mSpecialCounts.resize(mEvents.size());
+    mPool.run(chunks, [&](size_t k) {
+        for(auto e = mChunks[k]; e < mChunks[k + 1]; ++e) {
+            auto size = mEvents[e].end - mEvents[e].begin;
+            mCounts[e] = uint32_t(countPayload(data + mEvents[e].begin, size));
+            mSpecialCounts[e] = uint32_t(size - mCounts[e]);
+        }
+    });
+
+    auto first = batch.eventCount();
+    batch.appendEvents(mCounts.data(), mSpecialCounts.data(), mCounts.size(), timestamp);
+    for(size_t e = 0; e < mEvents.size(); ++e) {
+        auto& event = mEvents[e];
+        event.header.special = mSpecialCounts[e];
+        batch.setEvent(first + e, event.trigger, event.header);
+    }
+
+    mPool.run(chunks, [&](size_t k) {
+        for(auto e = mChunks[k]; e < mChunks[k + 1]; ++e) {
+            auto hit = batch.eventBegin(first + e);
+            auto word = batch.specialBegin(first + e);
+            auto emit = [&batch, &hit](uint32_t channel, uint32_t time) { batch.setHit(hit++, channel, time, LEADING); };
+            auto special = [&batch, &word](uint32_t w) { batch.setSpecial(word++, w); };
+            decodePayload(data + mEvents[e].begin, mEvents[e].end - mEvents[e].begin, emit, special);
+        }
+    });
+}
+
+void EmissDecoder::findMarkers(const uint32_t* data, size_t size) {
+    mMarkers.clear();
+    switch(mIsa) {
+#ifdef EMISS_DECODER_X86
+    case Isa::avx2:
+        return findMarkersAvx2(data, size, mMarkers);
+    case Isa::sse2:
+        return findMarkersSse2(data, size, mMarkers);
+#endif
+    default:
+        return findMarkersScalar(data, 0, size, mMarkers);
+    }
+}
+
+template<typename Emit, typename Special>
+void EmissDecoder::decodePayload(const uint32_t* data, size_t size, Emit& emit, Special& special) const {
+    switch(mIsa) {
+#ifdef EMISS_DECODER_X86
+    case Isa::avx2:
+        return decodePayloadAvx2(data, size, emit, special);
+    case Isa::sse2:
+        return decodePayloadSse2(data, size, emit, special);
+#endif
+    default:
+        return decodePayloadScalar(data, size, emit, special);
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "tdc.hpp"
+#include "simdisa.hpp"
+#include "workerpool.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Декодер данных E-Miss. Сначала векторным сравнением находятся все
+ * маркеры событий 0xFFFFFFFF, затем слова каждого события декодируются
+ * без проверок границ блоками по 8 (AVX2) или 4 (SSE2) слова.
+ * Большой буфер делится по маркерам между потоками пула: сначала считаются
+ * хиты каждого события, затем потоки пишут хиты сразу на свои места в пакете.
+ */
+class EmissDecoder {
+public:
+    using Isa = SimdIsa;
+    // Пропуски номеров триггеров и ошибки формата, накапливаются до resetStats()
+    struct Stats {
+        uintmax_t events    = 0;
+        uintmax_t gaps      = 0;
+        uintmax_t lost      = 0;
+        uintmax_t truncated = 0;
+    };
+public:
+    explicit EmissDecoder(Isa isa = supportedSimdIsa());
+
+    /*
+     * События дописываются в конец batch, номера событий берутся из eventNumber.
+     * Если задано слово заголовка с номером триггера, номером события
+     * становятся его младшие 16 бит: номер повторяется через 65536 триггеров,
+     * пропуски считаются по модулю 65536. Специальные слова (0b10, 0b11)
+     * сохраняются в batch без разбора полей.
+     */
+    void decodeEvents(const uint32_t* data,
+                      size_t size,
+                      int64_t timestamp,
+                      uint32_t& eventNumber,
+                      EventBatch& batch);
+
+    /*
+     * Хиты без разбиения на события, для непрерывного режима.
+     * headerSkip - слова заголовка, перешедшие из предыдущей передачи.
+     */
+    void decodeHits(const uint32_t* data, size_t size, size_t& headerSkip, std::vector<Tdc::Hit>& hits);
+
+    Isa isa() const { return mIsa; }
+
+    // Может вызываться из другого потока, применяется со следующего вызова decodeEvents
+    void setThreads(unsigned threads);
+    unsigned threads() const { return mThreads; }
+
+    // Индекс слова заголовка (0..3) с номером триггера, -1 - нумерация при чтении.
+    // Может вызываться из другого потока, применяется со следующего вызова decodeEvents
+    void setTriggerWord(int index);
+    int triggerWord() const { return mTriggerWord; }
+
+    // Читаются в потоке декодирования; сброс применяется со следующего вызова decodeEvents
+    const Stats& stats() const { return mStats; }
+    void resetStats();
+protected:
+    struct Event {
+        size_t      begin;
+        size_t      end;
+        uint32_t    trigger;
+        EventHeader header;
+    };
+
+    void findMarkers(const uint32_t* data, size_t size);
+    void findEvents(const uint32_t* data, size_t size, uint32_t& eventNumber);
+    void decodeParallel(const uint32_t* data, unsigned threads, int64_t timestamp, EventBatch& batch);
+    template<typename Emit, typename Special>
+    void decodePayload(const uint32_t* data, size_t size, Emit& emit, Special& special) const;
+private:
+    Isa mIsa;
+    std::atomic<unsigned> mThreads;
+    WorkerPool mPool;
+    std::vector<size_t> mMarkers;
+    std::vector<Event> mEvents;
+    std::vector<uint32_t> mCounts;
+    std::vector<uint32_t> mSpecialCounts;
+    std::vector<size_t> mChunks;
+    std::atomic<int> mTriggerWord;
+    std::atomic_bool mResetStats;
+    // Слово триггера, действующее в потоке декодирования
+    int mLatchedWord;
+    bool mTriggerValid;
+    uint32_t mNextTrigger;
+    Stats mStats;
+};
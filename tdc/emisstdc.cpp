@@ -1,17 +1,46 @@
 #include "emisstdc.hpp"
 
 #include <gsl/gsl_util.h>
+#include <algorithm>
 #include <iostream>
+#include <chrono>
+#include <thread>
 
 using std::logic_error;
 using std::runtime_error;
 using std::string;
 using std::vector;
+using std::chrono::milliseconds;
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+
+//Короткие передачи непрерывного режима, чтобы хиты поступали с малой задержкой
+static constexpr size_t hitTransferSize  = 16*1024;
+static constexpr size_t hitTransferCount = 8;
+
+static int64_t hostTime() {
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
 
 EmissTdc::EmissTdc()
     : mEM1(0170000),
-      mEM8({0x86, 5000, 0}) {
-    mBuffer.reserve(16*1024*1024);
+      mEM8({0x86, 5000, 0}),
+      mBuffer(16*1024*1024),
+      mBudget(16*1024*1024),
+      mCarry(0),
+      mEventNumber(0),
+      mMode(Mode::trigger),
+      mHeaderSkip(0),
+      mGateLast(0),
+      mGateClosed(0),
+      mStatsStart(steady_clock::now()),
+      mEvents(0),
+      mGaps(0),
+      mLost(0),
+      mTruncated(0) {
+    mDecoder.setThreads(std::max(1u, std::min(4u, std::thread::hardware_concurrency())));
 }
 
 void EmissTdc::open() {
@@ -26,8 +55,7 @@ void EmissTdc::open() {
     }
     mEM1.resetQbus();
     mEM1.setAR();
-    mEM1.generateSignal(ContrEM1::TypeSignal::pulse, 0);
-    mEM1.generateSignal(ContrEM1::TypeSignal::potential, 1);
+    mEM1.generateSignals({{ContrEM1::TypeSignal::pulse, 0}, {ContrEM1::TypeSignal::potential, 1}});
 }
 
 void EmissTdc::close() {
@@ -36,6 +64,7 @@ void EmissTdc::close() {
     mEM1.resetSignal(1);
     mEM1.close();
     mEM8.close();
+    mMode = Mode::trigger;
 }
 
 bool EmissTdc::isOpen() const {
@@ -53,57 +82,203 @@ const string& EmissTdc::name() const {
     return n;
 }
 
-void EmissTdc::readEvents(vector<EventHits>& buffer)  {
-    buffer.clear();
+void EmissTdc::readEvents(EventBatch& batch)  {
+    readRaw(mRaw);
+    decodeRaw(mRaw, batch);
+}
+
+void EmissTdc::readRaw(RawData& raw) {
+    if(mMode != Mode::trigger)
+        throw logic_error("EmissTdc::readEvents trigger mode required");
+    raw.clear();
+    if(mBudget != mBuffer.capacity()) {
+        mBuffer = TransferBuffer(mBudget);
+        mCarry = 0;
+    }
+    if(mEM8.isStreaming())
+        return readStream(raw);
+    size_t size = 0;
+    size_t transfered = 0;
+    auto closed = steady_clock::now();
     mEM1.resetSignal(1);
-    auto f = gsl::finally([&]{
-        mEM1.generateSignal(ContrEM1::TypeSignal::pulse, 0);
-        mEM1.generateSignal(ContrEM1::TypeSignal::potential, 1);
-    });
-    mBuffer.resize(16*1024*1024);
-    auto transfered = mEM8.readData(mBuffer);
-    if(transfered >= 4*1024*1024)
-        throw runtime_error("EmissTdc::readEvents buffer overflow");
+    {
+        //Ворота открываются сразу после передачи, декодирование идет при открытых воротах
+        auto f = gsl::finally([&]{ rearmGate(closed); });
+        auto request = mBuffer.capacity();
+        auto n = mEM8.readData(mBuffer.data(), request);
+        transfered += n;
+        size += n;
+        //Буфер заполнен целиком - контроллер не опустел. Готовые события
+        //переносятся в raw, чтобы освободить место, незавершенное событие остается
+        while(n == request) {
+            size = moveComplete(size, raw);
+            if(size == mBuffer.capacity())
+                throw runtime_error("EmissTdc::readEvents event exceeds buffer budget");
+            request = mBuffer.capacity() - size;
+            n = mEM8.drainData(mBuffer.data() + size, request);
+            transfered += n;
+            size += n;
+        }
+    }
     std::cout << "transfered: " << transfered << '\n';
-    mBuffer.resize(transfered);
+    raw.append(mBuffer.data(), mBuffer.data() + size, hostTime());
+}
 
-    size_t start = 0;
-    for(size_t j = 0; j < mBuffer.size(); ++j) {
-        if(mBuffer.at(j) == 0xFFFFFFFF) {
-            start = j;
-            break;
+void EmissTdc::decodeRaw(RawData& raw, EventBatch& batch) {
+    batch.clear();
+    for(auto& block : raw.blocks)
+        mDecoder.decodeEvents(raw.words.data() + block.begin, block.end - block.begin,
+                              block.timestamp, mEventNumber, batch);
+    auto& stats = mDecoder.stats();
+    mEvents = stats.events;
+    mGaps = stats.gaps;
+    mLost = stats.lost;
+    mTruncated = stats.truncated;
+}
+
+/*
+ * Завершенные передачи копируются в mBuffer вслед за остатком прошлого
+ * чтения. В raw переносятся события до последнего маркера, событие после
+ * него может продолжиться в следующей передаче и остается. Если
+ * передача не помещается, сначала переносится накопленное; пока
+ * передача не возвращена, она не отправляется повторно, и при отставании
+ * чтения USB-контроллер придерживает данные.
+ */
+void EmissTdc::readStream(RawData& raw) {
+    auto size = mCarry;
+    ContrEM8::Chunk* chunk;
+    while(mEM8.popChunk(chunk, milliseconds(0))) {
+        auto& data = chunk->buffer;
+        if(size + data.size() > mBuffer.capacity())
+            size = moveComplete(size, raw);
+        if(size + data.size() > mBuffer.capacity()) {
+            mEM8.releaseChunk(chunk);
+            mCarry = 0;
+            throw runtime_error("EmissTdc::readEvents event exceeds buffer budget");
         }
+        std::copy(data.data(), data.data() + data.size(), mBuffer.data() + size);
+        size += data.size();
+        mEM8.releaseChunk(chunk);
     }
-    for(size_t i = start; i < mBuffer.size(); ++i) {
-        if(mBuffer.at(i) == 0xFFFFFFFF) {
-            i += 5;
-            buffer.emplace_back();
-        }
-        uint32_t module;
-        uint32_t word;
-        while(i < mBuffer.size()) {
-            if(mBuffer.at(i) == 0xFFFFFFFF) {
-                --i;
-                break;
-            }
-            word = uint16_t(mBuffer.at(i)&0xFFFF);
-            module = uint16_t((mBuffer.at(i)>>16)&0x3F);
-            if((word >> 15) == 0) {
-                auto chan = (word >> 10) + 32*module;
-                auto time = word & 0x3FF;
-                buffer.back().emplace_back(EdgeDetection::leading, chan + module*32, 8*time);
-            } if((word >> 14) == 0b10) {
-                //TODO
-            } else if((word >> 14) == 0b11) {
-                //TODO
-            }
-            ++i;
+    mCarry = moveComplete(size, raw);
+}
+
+/*
+ * Переносит в raw события mBuffer[0, size) до последнего маркера и
+ * сдвигает остаток в начало буфера. Возвращает размер остатка.
+ */
+size_t EmissTdc::moveComplete(size_t size, RawData& raw) {
+    auto last = size;
+    while(last > 0 && mBuffer[last - 1] != 0xFFFFFFFF)
+        --last;
+    if(last <= 1)
+        return size;
+    --last;
+    raw.append(mBuffer.data(), mBuffer.data() + last, hostTime());
+    std::copy(mBuffer.data() + last, mBuffer.data() + size, mBuffer.data());
+    return size - last;
+}
+
+void EmissTdc::startStream() {
+    if(!isOpen())
+        throw logic_error("EmissTdc::startStream device is closed");
+    if(mMode != Mode::trigger)
+        throw logic_error("EmissTdc::startStream trigger mode required");
+    mCarry = 0;
+    mEM8.startStream();
+}
+
+void EmissTdc::stopStream() {
+    mEM8.stopStream();
+    mCarry = 0;
+}
+
+bool EmissTdc::isStreaming() const {
+    return mEM8.isStreaming();
+}
+
+void EmissTdc::setBufferBudget(size_t words) {
+    if(words < 1024*1024)
+        throw logic_error("EmissTdc::setBufferBudget budget is too small");
+    mBudget = words;
+}
+
+size_t EmissTdc::bufferBudget() const {
+    return mBudget;
+}
+
+void EmissTdc::setDecodeThreads(unsigned threads) {
+    mDecoder.setThreads(threads);
+}
+
+unsigned EmissTdc::decodeThreads() const {
+    return mDecoder.threads();
+}
+
+void EmissTdc::setTriggerWord(int index) {
+    mDecoder.setTriggerWord(index);
+}
+
+int EmissTdc::triggerWord() const {
+    return mDecoder.triggerWord();
+}
+
+EmissTdc::DecodeStats EmissTdc::decodeStats() const {
+    return {mEvents, mGaps, mLost, mTruncated};
+}
+
+EmissTdc::BusStats EmissTdc::busStats() const {
+    auto bus = mEM1.busCounters();
+    auto shadow = mEM1.shadowCounters();
+    return {bus.syscalls, bus.operations, shadow.readsAvoided, shadow.writesAvoided, shadow.statusPolls};
+}
+
+/*
+ * В непрерывном режиме ворота не закрываются, данные идут короткими
+ * асинхронными передачами и декодируются в хиты без разбиения на события.
+ */
+void EmissTdc::readHits(vector<Hit>& buffer)  {
+    if(mMode != Mode::continuous)
+        throw logic_error("EmissTdc::readHits continuous mode required");
+    buffer.clear();
+    ContrEM8::Chunk* chunk;
+    while(mEM8.popChunk(chunk, milliseconds(0))) {
+        try {
+            mDecoder.decodeHits(chunk->buffer.data(), chunk->buffer.size(), mHeaderSkip, buffer);
+        } catch(...) {
+            mEM8.releaseChunk(chunk);
+            throw;
         }
+        mEM8.releaseChunk(chunk);
     }
 }
 
-void EmissTdc::readHits(vector<Hit>& buffer)  {
-    throw runtime_error("Not implemented");
+void EmissTdc::rearmGate(steady_clock::time_point closed) {
+    mEM1.generateSignals({{ContrEM1::TypeSignal::pulse, 0}, {ContrEM1::TypeSignal::potential, 1}});
+    auto dead = duration_cast<microseconds>(steady_clock::now() - closed).count();
+    mGateLast = dead;
+    mGateClosed += dead;
+}
+
+EmissTdc::GateStats EmissTdc::gateStats() const {
+    return {
+        microseconds(mGateLast),
+        microseconds(mGateClosed),
+        duration_cast<microseconds>(steady_clock::now() - mStatsStart.load()),
+    };
+}
+
+void EmissTdc::printStats(std::ostream& stream) const {
+    auto stats = gateStats();
+    auto fraction = stats.elapsed.count() != 0 ? double(stats.closed.count()) / stats.elapsed.count() : 0.0;
+    stream << "Gate closed:    " << stats.closed.count() << " us of " << stats.elapsed.count()
+           << " us (" << 100*fraction << "%)\n";
+    stream << "Events:         " << mEvents << '\n'
+           << "Trigger gaps:   " << mGaps << " (lost " << mLost << ")\n"
+           << "Truncated:      " << mTruncated << '\n';
+    auto bus = busStats();
+    stream << "QBus syscalls:  " << bus.syscalls << " for " << bus.operations << " register operations\n"
+           << "QBus avoided:   " << bus.readsAvoided << " reads, " << bus.writesAvoided << " writes\n";
 }
 
 Tdc::Settings EmissTdc::settings()  {
@@ -115,15 +290,47 @@ Tdc::Settings EmissTdc::settings()  {
     };
 }
 
+/*
+ * В непрерывном режиме clear() предшествует каждому измерению частоты:
+ * передачи в полете могут нести данные до clear(), поэтому поток
+ * перезапускается, а счетчики набора не трогаются. В режиме триггера
+ * clear() начинает набор и сбрасывает его счетчики.
+ */
 void EmissTdc::clear()  {
+    if(mMode == Mode::continuous) {
+        mEM8.stopStream();
+        mHeaderSkip = 0;
+        mEM8.startStream(hitTransferSize, hitTransferCount);
+        return;
+    }
+    resetStats();
     //mEM1.generateSignal(ContrEM1::TypeSignal::pulse, 0);
 }
 
+void EmissTdc::resetStats() {
+    mEventNumber = 0;
+    mDecoder.resetStats();
+    mEvents = 0;
+    mGaps = 0;
+    mLost = 0;
+    mTruncated = 0;
+    mGateLast = 0;
+    mGateClosed = 0;
+    mEM1.resetBusCounters();
+    mStatsStart = steady_clock::now();
+}
+
 Tdc::Mode EmissTdc::mode()  {
-    return Mode::trigger;
+    return mMode;
 }
 
 void EmissTdc::setMode(Mode mode)  {
-    if(mode != Mode::trigger)
-        throw logic_error("EmissTdc::setMode only trigger mode supported");
+    if(mode == mMode)
+        return;
+    mEM8.stopStream();
+    mCarry = 0;
+    mHeaderSkip = 0;
+    if(mode == Mode::continuous)
+        mEM8.startStream(hitTransferSize, hitTransferCount);
+    mMode = mode;
 }
@@ -1,9 +1,14 @@
 #pragma once
 
 #include "tdc.hpp"
+#include "emissdecoder.hpp"
 
 #include "emiss/controlerem1.hpp"
 #include "emiss/controlerem8.hpp"
+#include "emiss/transferbuffer.hpp"
+
+#include <atomic>
+#include <chrono>
 //base - 0170000
 class EmissTdc : public Tdc {
 public:
@@ -11,8 +16,10 @@ public:
     void open();
     void close();
     
-    void readEvents(std::vector<EventHits>& buffer) override;
+    void readEvents(EventBatch& batch) override;
     void readHits(std::vector<Hit>& buffer) override;
+    void readRaw(RawData& raw) override;
+    void decodeRaw(RawData& raw, EventBatch& batch) override;
     const std::string& name() const override;
     Settings settings() override;
     bool isOpen() const override;
@@ -20,8 +27,76 @@ public:
     Mode mode() override;
     uint16_t stat();
     void setMode(Mode mode) override;
+
+    // Непрерывное чтение USB без закрытия ворот между чтениями
+    void startStream();
+    void stopStream();
+    bool isStreaming() const;
+
+    // Время закрытых ворот: последний цикл, сумма и время с начала набора
+    struct GateStats {
+        std::chrono::microseconds last;
+        std::chrono::microseconds closed;
+        std::chrono::microseconds elapsed;
+    };
+    GateStats gateStats() const;
+    void printStats(std::ostream& stream) const override;
+
+    // Предельный размер буфера чтения в словах; применяется при следующем чтении
+    void setBufferBudget(size_t words);
+    size_t bufferBudget() const;
+
+    // Число потоков декодирования больших передач
+    void setDecodeThreads(unsigned threads);
+    unsigned decodeThreads() const;
+
+    // Слово заголовка с номером триггера, -1 - нумерация событий при чтении
+    void setTriggerWord(int index);
+    int triggerWord() const;
+
+    // Счетчики декодера с начала набора
+    struct DecodeStats {
+        uintmax_t events;
+        uintmax_t gaps;
+        uintmax_t lost;
+        uintmax_t truncated;
+    };
+    DecodeStats decodeStats() const;
+
+    // Обращения к QBus с начала набора
+    struct BusStats {
+        uintmax_t syscalls;
+        uintmax_t operations;
+        uintmax_t readsAvoided;
+        uintmax_t writesAvoided;
+        uintmax_t statusPolls;
+    };
+    BusStats busStats() const;
+protected:
+    void readStream(RawData& raw);
+    // Сброс счетчиков набора, вызывается clear() в режиме триггера
+    void resetStats();
+    void rearmGate(std::chrono::steady_clock::time_point closed);
+    size_t moveComplete(size_t size, RawData& raw);
 private:
     ContrEM1 mEM1;
     ContrEM8 mEM8;
-    std::vector<uint32_t> mBuffer;
+    TransferBuffer mBuffer;
+    RawData mRaw;
+    std::atomic<size_t> mBudget;
+    EmissDecoder mDecoder;
+    // Слова незавершенного события, оставшиеся от предыдущего чтения потока
+    size_t mCarry;
+    // Номер события при нумерации при чтении (слово триггера не задано)
+    uint32_t mEventNumber;
+    std::atomic<Mode> mMode;
+    size_t mHeaderSkip;
+    std::atomic<int64_t> mGateLast;
+    std::atomic<int64_t> mGateClosed;
+    std::atomic<std::chrono::steady_clock::time_point> mStatsStart;
+    // Копии счетчиков декодера для чтения из других потоков
+    std::atomic<uintmax_t> mEvents;
+    std::atomic<uintmax_t> mGaps;
+    std::atomic<uintmax_t> mLost;
+    std::atomic<uintmax_t> mTruncated;
 };
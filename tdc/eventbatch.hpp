@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Служебные слова события: заголовок, число специальных слов и признаки ошибок формата
+struct EventHeader {
+    enum Flags : uint32_t {
+        truncated = 1, /* Заголовок оборван маркером или концом данных */
+    };
+    std::array<uint32_t, 4> words;
+    uint32_t special;
+    uint32_t flags;
+};
+
+/*
+ * Пакет событий в виде столбцов: хиты всех событий лежат подряд
+ * (канал, время, фронт отдельными массивами), а границы событий
+ * задаются массивом смещений. Хиты события i - [eventBegin(i), eventEnd(i)).
+ * Для каждого события хранится номер триггера, время чтения на хосте
+ * (steady_clock, нс) и служебные слова. Специальные (не хиты) слова
+ * события хранятся подряд так же, как хиты: [specialBegin(i), specialEnd(i)).
+ * clear() сохраняет выделенную память, поэтому повторное заполнение
+ * пакета того же размера не выделяет память.
+ */
+class EventBatch {
+public:
+    EventBatch() : mOffsets(1, 0), mSpecialOffsets(1, 0) { }
+
+    void clear() {
+        mChannels.clear();
+        mTimes.clear();
+        mEdges.clear();
+        mOffsets.resize(1);
+        mTriggers.clear();
+        mTimestamps.clear();
+        mHeaders.clear();
+        mSpecials.clear();
+        mSpecialOffsets.resize(1);
+    }
+
+    void reserve(size_t events, size_t hits) {
+        mOffsets.reserve(events + 1);
+        mTriggers.reserve(events);
+        mTimestamps.reserve(events);
+        mHeaders.reserve(events);
+        mSpecialOffsets.reserve(events + 1);
+        mChannels.reserve(hits);
+        mTimes.reserve(hits);
+        mEdges.reserve(hits);
+    }
+
+    /*
+     * Резерв под дописывание еще events событий и hits хитов. Память растет
+     * не меньше чем вдвое, чтобы серия блоков, дописываемых в один пакет,
+     * не копировала столбцы на каждом блоке.
+     */
+    void reserveAppend(size_t events, size_t hits) {
+        reserve(grown(mTriggers.capacity(), eventCount() + events), grown(mChannels.capacity(), hitCount() + hits));
+    }
+
+    void beginEvent(uint32_t trigger, int64_t timestamp, const EventHeader& header = EventHeader()) {
+        mOffsets.push_back(mOffsets.back());
+        mTriggers.push_back(trigger);
+        mTimestamps.push_back(timestamp);
+        mHeaders.push_back(header);
+        mSpecialOffsets.push_back(mSpecialOffsets.back());
+    }
+
+    // Хит добавляется в последнее начатое событие
+    void addHit(uint32_t channel, uint32_t time, uint8_t edge) {
+        mChannels.push_back(channel);
+        mTimes.push_back(time);
+        mEdges.push_back(edge);
+        ++mOffsets.back();
+    }
+
+    // Специальное слово добавляется в последнее начатое событие
+    void addSpecial(uint32_t word) {
+        mSpecials.push_back(word);
+        ++mSpecialOffsets.back();
+    }
+
+    /*
+     * Добавляет count событий с заданным числом хитов и специальных слов.
+     * Номер и заголовок события задаются через setEvent, хиты и специальные
+     * слова - через setHit и setSpecial, в том числе из нескольких потоков
+     * по непересекающимся диапазонам.
+     */
+    void appendEvents(const uint32_t* hitCounts, const uint32_t* specialCounts, size_t count, int64_t timestamp) {
+        auto hits = mOffsets.back();
+        auto specials = mSpecialOffsets.back();
+        for(size_t i = 0; i < count; ++i) {
+            hits += hitCounts[i];
+            specials += specialCounts[i];
+            mOffsets.push_back(hits);
+            mSpecialOffsets.push_back(specials);
+        }
+        mTriggers.resize(mTriggers.size() + count);
+        mTimestamps.resize(mTimestamps.size() + count, timestamp);
+        mHeaders.resize(mHeaders.size() + count);
+        mChannels.resize(hits);
+        mTimes.resize(hits);
+        mEdges.resize(hits);
+        mSpecials.resize(specials);
+    }
+
+    void setEvent(size_t event, uint32_t trigger, const EventHeader& header) {
+        mTriggers[event] = trigger;
+        mHeaders[event] = header;
+    }
+
+    void setHit(size_t hit, uint32_t channel, uint32_t time, uint8_t edge) {
+        mChannels[hit] = channel;
+        mTimes[hit] = time;
+        mEdges[hit] = edge;
+    }
+
+    void setSpecial(size_t index, uint32_t word) {
+        mSpecials[index] = word;
+    }
+
+    bool empty() const { return mOffsets.size() == 1; }
+    size_t eventCount() const { return mOffsets.size() - 1; }
+    size_t hitCount() const { return mChannels.size(); }
+
+    size_t eventBegin(size_t event) const { return mOffsets[event]; }
+    size_t eventEnd(size_t event) const { return mOffsets[event + 1]; }
+    size_t eventSize(size_t event) const { return eventEnd(event) - eventBegin(event); }
+    uint32_t trigger(size_t event) const { return mTriggers[event]; }
+    int64_t timestamp(size_t event) const { return mTimestamps[event]; }
+    const EventHeader& header(size_t event) const { return mHeaders[event]; }
+    EventHeader& header(size_t event) { return mHeaders[event]; }
+
+    size_t specialCount() const { return mSpecials.size(); }
+    size_t specialBegin(size_t event) const { return mSpecialOffsets[event]; }
+    size_t specialEnd(size_t event) const { return mSpecialOffsets[event + 1]; }
+    uint32_t special(size_t index) const { return mSpecials[index]; }
+
+    uint32_t channel(size_t hit) const { return mChannels[hit]; }
+    uint32_t time(size_t hit) const { return mTimes[hit]; }
+    uint8_t edge(size_t hit) const { return mEdges[hit]; }
+
+    const uint32_t* channels() const { return mChannels.data(); }
+    const uint32_t* times() const { return mTimes.data(); }
+    const uint8_t* edges() const { return mEdges.data(); }
+    const uint32_t* specials() const { return mSpecials.data(); }
+private:
+    static size_t grown(size_t capacity, size_t needed) {
+        return needed <= capacity ? capacity : std::max(needed, 2 * capacity);
+    }
+
+    std::vector<uint32_t> mChannels;
+    std::vector<uint32_t> mTimes;
+    std::vector<uint8_t>  mEdges;
+    std::vector<uint32_t> mOffsets;
+    std::vector<uint32_t> mTriggers;
+    std::vector<int64_t>  mTimestamps;
+    std::vector<EventHeader> mHeaders;
+    std::vector<uint32_t> mSpecials;
+    std::vector<uint32_t> mSpecialOffsets;
+};
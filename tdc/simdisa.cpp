@@ -0,0 +1,24 @@
+#include "simdisa.hpp"
+
+SimdIsa supportedSimdIsa() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return SimdIsa::avx2;
+    if(__builtin_cpu_supports("sse2"))
+        return SimdIsa::sse2;
+#endif
+    return SimdIsa::scalar;
+}
+
+std::ostream& operator<<(std::ostream& stream, SimdIsa isa) {
+    switch(isa) {
+    case SimdIsa::scalar:
+        return stream << "scalar";
+    case SimdIsa::sse2:
+        return stream << "sse2";
+    case SimdIsa::avx2:
+        return stream << "avx2";
+    }
+    return stream;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <ostream>
+
+// Набор векторных инструкций для декодеров, выбирается во время выполнения
+enum class SimdIsa {
+    scalar = 0,
+    sse2   = 1,
+    avx2   = 2,
+};
+
+SimdIsa supportedSimdIsa();
+
+std::ostream& operator<<(std::ostream& stream, SimdIsa isa);
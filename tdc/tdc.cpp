@@ -1,6 +1,22 @@
 #include "tdc.hpp"
 
 #include <iostream>
+#include <thread>
+#include <utility>
+
+void Tdc::waitEvents(std::chrono::milliseconds timeout) {
+    std::this_thread::sleep_for(timeout);
+}
+
+void Tdc::readRaw(RawData& raw) {
+    raw.clear();
+    readEvents(raw.batch);
+}
+
+void Tdc::decodeRaw(RawData& raw, EventBatch& batch) {
+    batch.clear();
+    std::swap(batch, raw.batch);
+}
 
 std::ostream& operator<<(std::ostream& stream, Tdc::EdgeDetection ed) {
     switch(ed) {
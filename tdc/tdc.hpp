@@ -1,7 +1,11 @@
 #pragma once
 
+#include "eventbatch.hpp"
+
 #include <vector>
 #include <string>
+#include <chrono>
+#include <ostream>
 #include <cstddef>
 
 class Tdc {
@@ -27,13 +31,59 @@ public:
         EdgeDetection edgeDetection;
         unsigned      lsb;
     };
-    using EventHits = std::vector<Hit>;
+    /*
+     * Данные одного чтения до декодирования: слова модуля блоками со
+     * временем чтения на хосте. Модуль, который не разделяет чтение и
+     * декодирование, передает готовые события в batch.
+     */
+    struct RawData {
+        struct Block {
+            size_t  begin;
+            size_t  end;
+            int64_t timestamp;
+        };
+        std::vector<uint32_t> words;
+        std::vector<Block>    blocks;
+        unsigned              lsb = 0;
+        // Счетчик событий модуля на момент чтения, если он прочитан
+        uint32_t              counter = 0;
+        bool                  counterValid = false;
+        EventBatch            batch;
+
+        void clear() {
+            words.clear();
+            blocks.clear();
+            counterValid = false;
+            batch.clear();
+        }
+        bool empty() const { return words.empty() && batch.empty(); }
+        // Слова [begin, end) добавляются отдельным блоком
+        void append(const uint32_t* begin, const uint32_t* end, int64_t timestamp) {
+            if(begin == end)
+                return;
+            blocks.push_back({words.size(), words.size() + size_t(end - begin), timestamp});
+            words.insert(words.end(), begin, end);
+        }
+    };
 public:
     virtual ~Tdc() { }
 
-    virtual void readEvents(std::vector<EventHits>& buffer) = 0;
+    virtual void readEvents(EventBatch& batch) = 0;
     virtual void readHits(std::vector<Hit>& buffer) = 0;
+    /*
+     * Чтение без декодирования и декодирование прочитанного, чтобы
+     * декодировать в другом потоке. decodeRaw вызывается из одного потока
+     * в порядке чтений. По умолчанию readRaw читает события целиком.
+     */
+    virtual void readRaw(RawData& raw);
+    virtual void decodeRaw(RawData& raw, EventBatch& batch);
+    // Ожидание накопления данных перед чтением, не дольше timeout
+    virtual void waitEvents(std::chrono::milliseconds timeout);
     virtual const std::string& name() const = 0;
+    // Параметры чтения, которые записываются в файл meta
+    virtual void printMeta(std::ostream&) const { }
+    // Статистика чтения, дописывается в файл meta по окончании
+    virtual void printStats(std::ostream&) const { }
     virtual Settings settings() = 0;
     virtual bool isOpen() const = 0;
     virtual void clear() = 0;
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Постоянные потоки для параллельной обработки буфера.
+ * run(count, func) выполняет func(0) .. func(count - 1): задание 0 - в
+ * вызывающем потоке, остальные в рабочих, и возвращается после
+ * завершения всех. Недостающие потоки создаются при первом запросе.
+ */
+class WorkerPool {
+    using Mutex = std::mutex;
+    using Lock = std::unique_lock<Mutex>;
+    using Task = std::function<void(size_t)>;
+public:
+    WorkerPool()
+        : mTask(nullptr),
+          mCount(0),
+          mGeneration(0),
+          mPending(0),
+          mStop(false) { }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        {
+            Lock lk(mMutex);
+            mStop = true;
+        }
+        mStart.notify_all();
+        for(auto& w : mWorkers)
+            w.join();
+    }
+
+    void run(size_t count, const Task& task) {
+        if(count == 0)
+            return;
+        while(mWorkers.size() + 1 < count)
+            mWorkers.emplace_back(&WorkerPool::loop, this, mWorkers.size() + 1, mGeneration);
+        {
+            Lock lk(mMutex);
+            mTask = &task;
+            mCount = count;
+            mPending = count - 1;
+            mError = nullptr;
+            ++mGeneration;
+        }
+        mStart.notify_all();
+        std::exception_ptr error;
+        try {
+            task(0);
+        } catch(...) {
+            error = std::current_exception();
+        }
+        Lock lk(mMutex);
+        mDone.wait(lk, [this] { return mPending == 0; });
+        mTask = nullptr;
+        if(!error)
+            error = mError;
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+    size_t workers() const { return mWorkers.size(); }
+protected:
+    //generation - последнее задание на момент создания потока
+    void loop(size_t index, size_t generation) {
+        Lock lk(mMutex);
+        while(true) {
+            mStart.wait(lk, [&] { return mStop || mGeneration != generation; });
+            if(mStop)
+                return;
+            generation = mGeneration;
+            if(index >= mCount)
+                continue;
+            auto task = mTask;
+            lk.unlock();
+            std::exception_ptr error;
+            try {
+                (*task)(index);
+            } catch(...) {
+                error = std::current_exception();
+            }
+            lk.lock();
+            if(error && !mError)
+                mError = error;
+            if(--mPending == 0)
+                mDone.notify_one();
+        }
+    }
+private:
+    std::vector<std::thread> mWorkers;
+    const Task* mTask;
+    size_t mCount;
+    size_t mGeneration;
+    size_t mPending;
+    bool mStop;
+    std::exception_ptr mError;
+    Mutex mMutex;
+    std::condition_variable mStart;
+    std::condition_variable mDone;
+};
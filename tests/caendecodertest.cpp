@@ -0,0 +1,155 @@
+#include "check.hpp"
+#include "tdc/caendecoder.hpp"
+
+#include <random>
+#include <sstream>
+
+using std::vector;
+
+/*
+ * Векторные декодеры CAEN сравниваются со скалярным побитно на случайных
+ * потоках из слов всех типов. Скалярный декодер, в свою очередь,
+ * сверяется с прямым разбором формата V1190.
+ */
+
+static constexpr unsigned lsbValues[] = {781, 195, 98};
+static constexpr uint32_t wordTypes[] = {
+    0x00000000, 0x00000000, 0x00000000, 0x00000000, /* Измерения */
+    0x40000000, /* Глобальный заголовок */
+    0x80000000, /* Глобальное окончание */
+    0xC0000000, /* Заполнитель MBLT64 */
+    0x08000000, /* Заголовок TDC */
+    0x18000000, /* Окончание TDC */
+    0x20000000, /* Ошибка TDC */
+    0x88000000, /* Расширенная метка времени */
+};
+
+struct ReferenceHit {
+    uint32_t channel;
+    uint32_t time;
+    uint8_t  edge;
+};
+
+//Измерения до первого глобального заголовка отбрасываются, после окончания - идут в последнее событие
+static vector<vector<ReferenceHit>> decodeReference(unsigned lsb, const vector<uint32_t>& data) {
+    vector<vector<ReferenceHit>> events;
+    bool header = false;
+    for(auto word : data) {
+        auto type = word & 0xf8000000;
+        if(type == 0x00000000 && !events.empty())
+            events.back().push_back({(word & 0x03f80000) >> 19, lsb * (word & 0x7ffff), uint8_t((word >> 26) > 0 ? 1 : 0)});
+        else if(type == 0x40000000 && !header) {
+            events.emplace_back();
+            header = true;
+        } else if(type == 0x80000000 && header)
+            header = false;
+    }
+    return events;
+}
+
+static vector<uint32_t> randomStream(std::mt19937& rng, size_t size) {
+    static constexpr size_t typeCount = sizeof(wordTypes) / sizeof(wordTypes[0]);
+    vector<uint32_t> data(size);
+    for(auto& word : data) {
+        word = (rng() & 0x07ffffff) | wordTypes[rng() % typeCount];
+        if(rng() % 7 == 0)
+            word = rng();
+    }
+    return data;
+}
+
+static bool sameBatch(const EventBatch& a, const EventBatch& b) {
+    if(a.eventCount() != b.eventCount() || a.hitCount() != b.hitCount())
+        return false;
+    for(size_t e = 0; e < a.eventCount(); ++e) {
+        if(a.eventEnd(e) != b.eventEnd(e) ||
+           a.trigger(e) != b.trigger(e) ||
+           a.timestamp(e) != b.timestamp(e) ||
+           a.header(e).words != b.header(e).words ||
+           a.header(e).flags != b.header(e).flags)
+            return false;
+    }
+    for(size_t h = 0; h < a.hitCount(); ++h) {
+        if(a.channel(h) != b.channel(h) || a.time(h) != b.time(h) || a.edge(h) != b.edge(h))
+            return false;
+    }
+    return true;
+}
+
+static bool sameHits(const vector<Tdc::Hit>& a, const vector<Tdc::Hit>& b) {
+    if(a.size() != b.size())
+        return false;
+    for(size_t i = 0; i < a.size(); ++i) {
+        if(a[i].type != b[i].type || a[i].channel != b[i].channel || a[i].time != b[i].time)
+            return false;
+    }
+    return true;
+}
+
+static bool sameSequence(const CaenDecoder::Sequence& a, const CaenDecoder::Sequence& b) {
+    return a.valid == b.valid && a.next == b.next && a.gaps == b.gaps && a.lost == b.lost;
+}
+
+static bool matchesReference(const EventBatch& batch, const vector<vector<ReferenceHit>>& events) {
+    if(batch.eventCount() != events.size())
+        return false;
+    for(size_t e = 0; e < events.size(); ++e) {
+        if(batch.eventSize(e) != events[e].size())
+            return false;
+        for(size_t k = 0; k < events[e].size(); ++k) {
+            auto h = batch.eventBegin(e) + k;
+            if(batch.channel(h) != events[e][k].channel ||
+               batch.time(h) != events[e][k].time ||
+               batch.edge(h) != events[e][k].edge)
+                return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    static constexpr int streams = 3000;
+    std::mt19937 rng(1);
+    CaenDecoder scalar(SimdIsa::scalar);
+    vector<CaenDecoder> decoders;
+    for(int isa = int(SimdIsa::sse2); isa <= int(CaenDecoder::supportedIsa()); ++isa)
+        decoders.emplace_back(SimdIsa(isa));
+    if(decoders.empty())
+        std::cout << "caendecodertest: no SIMD support, only the scalar decoder is checked" << std::endl;
+
+    for(int s = 0; s < streams; ++s) {
+        //Длинные потоки проходят основной цикл, короткие - только хвост
+        size_t size = (s % 100 == 0) ? 20000 + rng() % 20000 : rng() % 300;
+        auto data = randomStream(rng, size);
+        //Поток делится на две передачи: номера событий сверяются между вызовами
+        size_t split = size == 0 ? 0 : rng() % size;
+        for(auto lsb : lsbValues) {
+            EventBatch expected;
+            CaenDecoder::Sequence expectedSeq;
+            scalar.decodeEvents(lsb, data.data(), split, s, expectedSeq, expected);
+            scalar.decodeEvents(lsb, data.data() + split, size - split, s + 1, expectedSeq, expected);
+            vector<Tdc::Hit> expectedHits;
+            scalar.decodeHits(lsb, data.data(), size, expectedHits);
+
+            EventBatch whole;
+            CaenDecoder::Sequence wholeSeq;
+            scalar.decodeEvents(lsb, data.data(), size, s, wholeSeq, whole);
+            check(matchesReference(whole, decodeReference(lsb, data)), "scalar decoder matches the V1190 format");
+
+            for(auto& decoder : decoders) {
+                std::ostringstream what;
+                what << "stream " << s << " lsb " << lsb << " isa " << decoder.isa();
+                EventBatch batch;
+                CaenDecoder::Sequence seq;
+                decoder.decodeEvents(lsb, data.data(), split, s, seq, batch);
+                decoder.decodeEvents(lsb, data.data() + split, size - split, s + 1, seq, batch);
+                check(sameBatch(expected, batch), ("events differ: " + what.str()).c_str());
+                check(sameSequence(expectedSeq, seq), ("sequence differs: " + what.str()).c_str());
+                vector<Tdc::Hit> hits;
+                decoder.decodeHits(lsb, data.data(), size, hits);
+                check(sameHits(expectedHits, hits), ("hits differ: " + what.str()).c_str());
+            }
+        }
+    }
+    return checkResult("caendecodertest");
+}
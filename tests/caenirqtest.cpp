@@ -0,0 +1,100 @@
+#include "caenvmemock.hpp"
+#include "check.hpp"
+#include "tdc/caenv2718.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+//Глобальный заголовок, хиты на каналах 0..hits-1 и глобальное окончание
+static std::vector<uint32_t> makeEvent(uint32_t number, unsigned hits) {
+    std::vector<uint32_t> words{0x40000000u | (number << 5)};
+    for(uint32_t ch = 0; ch < hits; ++ch)
+        words.push_back((ch << 19) | (100 + ch));
+    words.push_back(0x80000000u);
+    return words;
+}
+
+static double elapsedMs(steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+int main() {
+    caenmock::reset();
+    CaenV2718 tdc(0xEE42);
+    tdc.open();
+    tdc.setAlmostFull(64);
+    tdc.setInterruptLevel(3);
+    check(caenmock::interruptLevel() == 3, "interrupt level register");
+    check(caenmock::interruptVector() == 0x42, "interrupt vector is the low byte of the address");
+
+    //Без данных ожидание длится весь timeout
+    auto start = steady_clock::now();
+    tdc.waitEvents(milliseconds(50));
+    check(elapsedMs(start) >= 45, "waitEvents waits for the timeout without IRQ");
+
+    //IRQ будит ожидание раньше timeout, событие читается
+    std::thread module([] {
+        std::this_thread::sleep_for(milliseconds(20));
+        caenmock::pushData(makeEvent(0, 4), 1);
+        caenmock::raiseIrq();
+    });
+    start = steady_clock::now();
+    tdc.waitEvents(milliseconds(2000));
+    auto woke = elapsedMs(start);
+    module.join();
+    check(woke < 1000, "waitEvents returns on IRQ");
+    EventBatch batch;
+    tdc.readEvents(batch);
+    check(batch.eventCount() == 1 && batch.hitCount() == 4, "event read after IRQ");
+
+    //Заполнение до almostFull выставляет IRQ без raiseIrq
+    std::vector<uint32_t> burst;
+    for(uint32_t i = 1; i <= 16; ++i) {
+        auto event = makeEvent(i, 3);
+        burst.insert(burst.end(), event.begin(), event.end());
+    }
+    caenmock::pushData(burst, 16);
+    start = steady_clock::now();
+    tdc.waitEvents(milliseconds(2000));
+    check(elapsedMs(start) < 1000, "waitEvents returns on almostFull IRQ");
+    batch.clear();
+    tdc.readEvents(batch);
+    check(batch.eventCount() == 16, "burst read after IRQ");
+    check(tdc.counterMismatches() == 0 && tdc.triggerGaps() == 0, "event counter consistent");
+
+    //Обращения к регистрам из другого потока во время ожидания прерываний
+    std::atomic_bool stop(false);
+    std::thread reader([&] {
+        while(!stop) {
+            tdc.eventStored();
+            tdc.stat();
+        }
+    });
+    std::thread irqs([&] {
+        for(int i = 0; i < 50; ++i) {
+            std::this_thread::sleep_for(milliseconds(1));
+            caenmock::raiseIrq();
+        }
+    });
+    for(int i = 0; i < 50; ++i)
+        tdc.waitEvents(milliseconds(5));
+    //getTrigConf (5 слов), getDetection и getLSB: handshake перед каждым словом
+    auto stats = tdc.updateSettings();
+    check(stats.cycles == 2 * (3 + 5 + 1 + 1), "transaction cycles exclude other threads");
+    irqs.join();
+    stop = true;
+    reader.join();
+
+    auto before = caenmock::calls();
+    check(before.irqEnable > 0 && before.irqWait > 0 && before.iack > 0, "IRQ calls issued");
+    tdc.close();
+    auto after = caenmock::calls();
+    check(after.irqDisable > before.irqDisable, "close disables IRQ");
+    check(after.overlaps == 0, "CAENVME calls other than IRQWait never overlap");
+
+    return checkResult("caenirqtest");
+}
@@ -0,0 +1,139 @@
+#include "caenvmemock.hpp"
+#include "check.hpp"
+#include "tdc/caenv2718.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+using Mode = CaenV2718::TransferMode;
+
+/*
+ * Все режимы передачи должны давать одни и те же события. Нечетное число
+ * слов проверяет округление запроса MBLT и пропуск слова-заполнителя,
+ * отказ моста от MBLT - переход на BLT32 без потери данных.
+ */
+
+static constexpr unsigned events = 40;
+
+//Глобальный заголовок, hits измерений и глобальное окончание: hits + 2 слов
+static std::vector<uint32_t> makeStream(uint32_t first = 0) {
+    std::vector<uint32_t> words;
+    for(uint32_t i = first; i < first + events; ++i) {
+        auto hits = 1 + i % 4;
+        words.push_back(0x40000000u | (i << 5));
+        for(uint32_t ch = 0; ch < hits; ++ch)
+            words.push_back((ch << 19) | (100 + i));
+        words.push_back(0x80000000u);
+    }
+    return words;
+}
+
+static bool readAll(CaenV2718& tdc, EventBatch& batch) {
+    for(int i = 0; i < 10 && batch.eventCount() < events; ++i)
+        tdc.readEvents(batch);
+    if(batch.eventCount() != events)
+        return false;
+    for(size_t e = 0; e < events; ++e) {
+        if(batch.trigger(e) != e || batch.eventSize(e) != 1 + e % 4)
+            return false;
+        for(auto h = batch.eventBegin(e); h < batch.eventEnd(e); ++h) {
+            if(batch.channel(h) != h - batch.eventBegin(e))
+                return false;
+        }
+    }
+    return true;
+}
+
+//Чтение в буфер нечетной емкости, как при дочитывании хвоста блока
+class OddReader : public CaenV2718 {
+public:
+    using CaenV2718::CaenV2718;
+    std::vector<uint32_t> readOdd(size_t capacity) {
+        std::vector<uint32_t> words, block(capacity);
+        for(int i = 0; i < 1000 && eventStored() != 0; ++i) {
+            auto size = readPending(block.data(), capacity);
+            if(is64Bit() && size % 2 != 0)
+                return {};
+            words.insert(words.end(), block.begin(), block.begin() + size);
+        }
+        return words;
+    }
+private:
+    bool is64Bit() const {
+        return transferMode() == TransferMode::mblt64 || transferMode() == TransferMode::fifoMblt64;
+    }
+};
+
+static std::vector<uint32_t> withoutFillers(std::vector<uint32_t> words) {
+    words.erase(std::remove(words.begin(), words.end(), 0xC0000000u), words.end());
+    return words;
+}
+
+static void readOdd(Mode mode) {
+    std::ostringstream what;
+    what << mode;
+    caenmock::reset();
+    OddReader tdc(0xEE00);
+    tdc.open();
+    tdc.setTransferMode(mode);
+    auto stream = makeStream();
+    caenmock::pushData(stream, events);
+    auto words = tdc.readOdd(33);
+    check(withoutFillers(words) == stream, ("odd capacity read: " + what.str()).c_str());
+    check(tdc.transferMode() == mode, ("transfer mode kept: " + what.str()).c_str());
+    tdc.close();
+}
+
+static void readMode(Mode mode, bool reject, Mode expected) {
+    std::ostringstream what;
+    what << mode << (reject ? " rejected" : "");
+    caenmock::reset();
+    caenmock::rejectMblt(reject);
+    CaenV2718 tdc(0xEE00);
+    tdc.open();
+    tdc.setTransferMode(mode);
+    auto stream = makeStream();
+    //Нечетная длина: последний блок MBLT дополняется заполнителем
+    if(stream.size() % 2 == 0)
+        stream.push_back(0xC0000000u);
+    caenmock::pushData(stream, events);
+    EventBatch batch;
+    check(readAll(tdc, batch), ("events read: " + what.str()).c_str());
+    check(tdc.transferMode() == expected, ("transfer mode: " + what.str()).c_str());
+    check(tdc.counterMismatches() == 0 && tdc.triggerGaps() == 0, ("event counter: " + what.str()).c_str());
+    tdc.close();
+}
+
+/*
+ * Декодирование отстает от чтения на одно чтение, как в конвейере набора:
+ * снимок eventCounter сверяется с событиями своего чтения, а не последнего.
+ */
+static void readPipelined() {
+    caenmock::reset();
+    CaenV2718 tdc(0xEE00);
+    tdc.open();
+    Tdc::RawData first, second;
+    caenmock::pushData(makeStream(), events);
+    tdc.readRaw(first);
+    caenmock::pushData(makeStream(events), events);
+    tdc.readRaw(second);
+    EventBatch batch;
+    tdc.decodeRaw(first, batch);
+    check(batch.eventCount() == events && batch.trigger(0) == 0, "first read decoded after the second read");
+    tdc.decodeRaw(second, batch);
+    check(batch.eventCount() == events && batch.trigger(0) == events, "second read decoded");
+    check(tdc.counterMismatches() == 0 && tdc.triggerGaps() == 0, "counter snapshot travels with its read");
+    tdc.close();
+}
+
+int main() {
+    for(auto mode : {Mode::blt32, Mode::mblt64, Mode::fifoBlt32, Mode::fifoMblt64})
+        readMode(mode, false, mode);
+    for(auto mode : {Mode::blt32, Mode::mblt64, Mode::fifoBlt32, Mode::fifoMblt64})
+        readOdd(mode);
+    readMode(Mode::mblt64, true, Mode::blt32);
+    readMode(Mode::fifoMblt64, true, Mode::blt32);
+    readMode(Mode::fifoBlt32, true, Mode::fifoBlt32);
+    readPipelined();
+    return checkResult("caentransfertest");
+}
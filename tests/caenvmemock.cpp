@@ -0,0 +1,323 @@
+#include "caenvmemock.hpp"
+
+#include <CAENVMElib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using Lock = std::unique_lock<std::mutex>;
+
+namespace {
+
+enum Reg : uint16_t {
+    outputBuffer    = 0x0000,
+    controlReg      = 0x1000,
+    interruptLevel  = 0x100A,
+    interruptVector = 0x100C,
+    eventCounter    = 0x101C,
+    eventStored     = 0x1020,
+    almostFull      = 0x1022,
+    micro           = 0x102E,
+    handshake       = 0x1030,
+};
+
+struct Board {
+    std::map<uint16_t, uint32_t> regs;
+    std::deque<uint32_t> buffer;
+    unsigned stored = 0;
+    uint32_t counter = 0;
+    // Ожидаемые слова данных команды и ответ микроконтроллера
+    unsigned microInput = 0;
+    std::deque<uint16_t> microOutput;
+    uint16_t mode = 1;
+    bool irqPending = false;
+    uint32_t irqMask = 0;
+    bool rejectMblt = false;
+    caenmock::Calls calls{};
+};
+
+std::mutex gMutex;
+std::condition_variable gIrq;
+Board gBoard;
+std::atomic<int> gActive(0);
+std::atomic<unsigned> gOverlaps(0);
+std::atomic<std::chrono::microseconds> gCycleTime(std::chrono::microseconds(0));
+std::chrono::microseconds gMicroTime(0);
+std::chrono::steady_clock::time_point gMicroReady;
+
+//Отмечает вызовы, выполняющиеся одновременно с другими, и занимает шину на время цикла
+class Guard {
+public:
+    Guard() {
+        if(gActive.fetch_add(1) != 0)
+            ++gOverlaps;
+        auto cycle = gCycleTime.load();
+        if(cycle.count() == 0) {
+            std::this_thread::yield();
+            return;
+        }
+        auto end = std::chrono::steady_clock::now() + cycle;
+        while(std::chrono::steady_clock::now() < end)
+            ;
+    }
+    ~Guard() { --gActive; }
+};
+
+uint16_t reg(uint32_t address) {
+    return uint16_t(address & 0xFFFF);
+}
+
+//IRQ по уровню заполнения, как у V1190 с almostFull
+void updateIrq() {
+    auto level = gBoard.regs[interruptLevel] & 0x7;
+    if(level != 0 && gBoard.buffer.size() >= gBoard.regs[almostFull])
+        gBoard.irqPending = true;
+    if(gBoard.irqPending)
+        gIrq.notify_all();
+}
+
+void writeMicro(uint16_t word) {
+    gMicroReady = std::chrono::steady_clock::now() + gMicroTime;
+    if(gBoard.microInput != 0) {
+        --gBoard.microInput;
+        return;
+    }
+    switch(word) {
+    case 0x0000: gBoard.mode = 1; break;
+    case 0x0100: gBoard.mode = 0; break;
+    case 0x0200: gBoard.microOutput.push_back(gBoard.mode); break;
+    case 0x1600: gBoard.microOutput.insert(gBoard.microOutput.end(), {20, uint16_t(-40), 0, 0, 1}); break;
+    case 0x2300: gBoard.microOutput.push_back(2); break;
+    case 0x2600: gBoard.microOutput.push_back(2); break;
+    case 0x3200: gBoard.microOutput.push_back(0); break;
+    case 0x1000:
+    case 0x1100:
+    case 0x2200:
+    case 0x2400:
+    case 0x2800:
+        gBoard.microInput = 1;
+        break;
+    default:
+        break;
+    }
+}
+
+//В 64-битных циклах нечетный остаток дополняется словом-заполнителем, как в V1190
+CVErrorCodes bltRead(uint32_t address, void* data, int size, int* count, bool mblt) {
+    Guard g;
+    Lock lk(gMutex);
+    if(reg(address) != outputBuffer)
+        return cvInvalidParam;
+    //MBLT передает только целые 64-битные слова
+    if(mblt && size % 8 != 0)
+        return cvInvalidParam;
+    if(mblt && gBoard.rejectMblt) {
+        *count = 0;
+        return cvInvalidParam;
+    }
+    auto words = std::min(size_t(size) / sizeof(uint32_t), gBoard.buffer.size());
+    auto out = static_cast<uint32_t*>(data);
+    for(size_t i = 0; i < words; ++i) {
+        out[i] = gBoard.buffer.front();
+        gBoard.buffer.pop_front();
+        if((out[i] & 0xf8000000) == 0x80000000)
+            --gBoard.stored;
+    }
+    if(mblt && (words & 1) && words * sizeof(uint32_t) < size_t(size))
+        out[words++] = 0xC0000000;
+    *count = int(words * sizeof(uint32_t));
+    //Конец данных при включенном BERR_EN
+    if(words * sizeof(uint32_t) < size_t(size))
+        return (gBoard.regs[controlReg] & 1) ? cvBusError : cvSuccess;
+    return cvSuccess;
+}
+
+}
+
+namespace caenmock {
+
+void reset() {
+    Lock lk(gMutex);
+    gBoard = Board();
+    gBoard.regs[almostFull] = 64;
+    gOverlaps = 0;
+}
+
+void setTiming(std::chrono::microseconds cycle, std::chrono::microseconds micro) {
+    Lock lk(gMutex);
+    gCycleTime = cycle;
+    gMicroTime = micro;
+}
+
+void pushData(const std::vector<uint32_t>& words, unsigned events) {
+    Lock lk(gMutex);
+    gBoard.buffer.insert(gBoard.buffer.end(), words.begin(), words.end());
+    gBoard.stored += events;
+    gBoard.counter += events;
+    updateIrq();
+}
+
+void raiseIrq() {
+    Lock lk(gMutex);
+    gBoard.irqPending = true;
+    gIrq.notify_all();
+}
+
+void rejectMblt(bool reject) {
+    Lock lk(gMutex);
+    gBoard.rejectMblt = reject;
+}
+
+Calls calls() {
+    Lock lk(gMutex);
+    auto c = gBoard.calls;
+    c.overlaps = gOverlaps;
+    return c;
+}
+
+uint16_t interruptLevel() {
+    Lock lk(gMutex);
+    return uint16_t(gBoard.regs[::interruptLevel]);
+}
+
+uint16_t interruptVector() {
+    Lock lk(gMutex);
+    return uint16_t(gBoard.regs[::interruptVector]);
+}
+
+}
+
+CVErrorCodes CAENVME_Init(CVBoardTypes, short, short, int32_t* handle) {
+    Guard g;
+    *handle = 1;
+    return cvSuccess;
+}
+
+CVErrorCodes CAENVME_End(int32_t) {
+    Guard g;
+    return cvSuccess;
+}
+
+const char* CAENVME_DecodeError(CVErrorCodes code) {
+    switch(code) {
+    case cvSuccess:      return "Operation completed successfully";
+    case cvBusError:     return "VME bus error during the cycle";
+    case cvCommError:    return "Communication error";
+    case cvInvalidParam: return "Invalid parameter";
+    case cvTimeoutError: return "Timeout error";
+    default:             return "Unspecified error";
+    }
+}
+
+CVErrorCodes CAENVME_ReadCycle(int32_t, uint32_t address, void* data, CVAddressModifier, CVDataWidth width) {
+    Guard g;
+    Lock lk(gMutex);
+    uint32_t value = 0;
+    switch(reg(address)) {
+    case handshake:
+        value = std::chrono::steady_clock::now() >= gMicroReady ? 3 : 0;
+        break;
+    case micro:
+        if(gBoard.microOutput.empty())
+            return cvCommError;
+        value = gBoard.microOutput.front();
+        gBoard.microOutput.pop_front();
+        break;
+    case eventStored:
+        value = gBoard.stored;
+        break;
+    case eventCounter:
+        value = gBoard.counter;
+        break;
+    default:
+        value = gBoard.regs[reg(address)];
+    }
+    if(width == cvD16) {
+        auto word = uint16_t(value);
+        std::memcpy(data, &word, sizeof(word));
+    } else {
+        std::memcpy(data, &value, sizeof(value));
+    }
+    return cvSuccess;
+}
+
+CVErrorCodes CAENVME_WriteCycle(int32_t, uint32_t address, void* data, CVAddressModifier, CVDataWidth width) {
+    Guard g;
+    Lock lk(gMutex);
+    uint32_t value = 0;
+    if(width == cvD16) {
+        uint16_t word;
+        std::memcpy(&word, data, sizeof(word));
+        value = word;
+    } else {
+        std::memcpy(&value, data, sizeof(value));
+    }
+    if(reg(address) == micro)
+        writeMicro(uint16_t(value));
+    else
+        gBoard.regs[reg(address)] = value;
+    updateIrq();
+    return cvSuccess;
+}
+
+CVErrorCodes CAENVME_BLTReadCycle(int32_t, uint32_t address, void* data, int size, CVAddressModifier, CVDataWidth, int* count) {
+    return bltRead(address, data, size, count, false);
+}
+
+CVErrorCodes CAENVME_MBLTReadCycle(int32_t, uint32_t address, void* data, int size, CVAddressModifier, int* count) {
+    return bltRead(address, data, size, count, true);
+}
+
+CVErrorCodes CAENVME_FIFOBLTReadCycle(int32_t, uint32_t address, void* data, int size, CVAddressModifier, CVDataWidth, int* count) {
+    return bltRead(address, data, size, count, false);
+}
+
+CVErrorCodes CAENVME_FIFOMBLTReadCycle(int32_t, uint32_t address, void* data, int size, CVAddressModifier, int* count) {
+    return bltRead(address, data, size, count, true);
+}
+
+CVErrorCodes CAENVME_IRQEnable(int32_t, uint32_t mask) {
+    Guard g;
+    Lock lk(gMutex);
+    ++gBoard.calls.irqEnable;
+    gBoard.irqMask |= mask;
+    return cvSuccess;
+}
+
+CVErrorCodes CAENVME_IRQDisable(int32_t, uint32_t mask) {
+    Guard g;
+    Lock lk(gMutex);
+    ++gBoard.calls.irqDisable;
+    gBoard.irqMask &= ~mask;
+    return cvSuccess;
+}
+
+//Только ожидание линии, может идти параллельно с другими вызовами
+CVErrorCodes CAENVME_IRQWait(int32_t, uint32_t mask, uint32_t timeout) {
+    Lock lk(gMutex);
+    ++gBoard.calls.irqWait;
+    auto ready = [&] {
+        auto level = gBoard.regs[interruptLevel] & 0x7;
+        return gBoard.irqPending && level != 0 && (mask & gBoard.irqMask & (1u << (level - 1)));
+    };
+    if(!gIrq.wait_for(lk, std::chrono::milliseconds(timeout), ready))
+        return cvTimeoutError;
+    return cvSuccess;
+}
+
+CVErrorCodes CAENVME_IACKCycle(int32_t, CVIRQLevels, void* vector, CVDataWidth) {
+    Guard g;
+    Lock lk(gMutex);
+    ++gBoard.calls.iack;
+    gBoard.irqPending = false;
+    auto word = uint16_t(gBoard.regs[interruptVector]);
+    std::memcpy(vector, &word, sizeof(word));
+    return cvSuccess;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Имитация CAENVMElib: один мост V2718 с модулем V1190. Регистры,
+ * микроконтроллер, выходной буфер и линия IRQ моделируются настолько,
+ * насколько их использует CaenV2718. Тест линкуется с этим файлом
+ * вместо библиотеки CAENVME.
+ */
+namespace caenmock {
+
+struct Calls {
+    unsigned irqEnable;
+    unsigned irqDisable;
+    unsigned irqWait;
+    unsigned iack;
+    // Вызовы, начатые, пока выполнялся другой вызов (кроме IRQWait)
+    unsigned overlaps;
+};
+
+void reset();
+// Длительность цикла VME и время выполнения команды микроконтроллера,
+// пока оно не истекло, handshake не готов. По умолчанию нули
+void setTiming(std::chrono::microseconds cycle, std::chrono::microseconds micro);
+// Данные в выходной буфер; events - число событий (глобальных окончаний) в words
+void pushData(const std::vector<uint32_t>& words, unsigned events);
+// Модуль выставляет IRQ независимо от заполнения буфера
+void raiseIrq();
+// Мост отвечает cvInvalidParam на циклы MBLT и FIFO MBLT
+void rejectMblt(bool reject);
+
+Calls calls();
+uint16_t interruptLevel();
+uint16_t interruptVector();
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <iostream>
+
+// Проверки тестов: ошибки печатаются и считаются, код возврата - по итогу
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline void check(bool condition, const char* what) {
+    if(!condition) {
+        std::cerr << "FAIL: " << what << std::endl;
+        ++checkFailures();
+    }
+}
+
+inline int checkResult(const char* test) {
+    if(checkFailures() != 0)
+        return 1;
+    std::cout << test << ": ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "check.hpp"
+#include "tdc/emissdecoder.hpp"
+
+#include <memory>
+#include <random>
+#include <sstream>
+
+using std::vector;
+
+/*
+ * Поиск маркеров и декодирование E-Miss сравниваются с прежним
+ * пословным разбором из EmissTdc::readEvents. Ветви специальных слов,
+ * оставленные там как TODO, здесь сохраняют слово в событие.
+ */
+
+struct Reference {
+    EventBatch batch;
+    vector<vector<uint32_t>> specials;
+};
+
+static void decodeOld(const vector<uint32_t>& buffer, uint32_t& eventNumber, Reference& ref) {
+    size_t start = buffer.size();
+    for(size_t j = 0; j < buffer.size(); ++j) {
+        if(buffer.at(j) == 0xFFFFFFFF) {
+            start = j;
+            break;
+        }
+    }
+    for(size_t i = start; i < buffer.size(); ++i) {
+        if(buffer.at(i) == 0xFFFFFFFF) {
+            i += 5;
+            ref.batch.beginEvent(eventNumber++, 0);
+            ref.specials.emplace_back();
+        }
+        uint32_t module;
+        uint32_t word;
+        while(i < buffer.size()) {
+            if(buffer.at(i) == 0xFFFFFFFF) {
+                --i;
+                break;
+            }
+            word = uint16_t(buffer.at(i)&0xFFFF);
+            module = uint16_t((buffer.at(i)>>16)&0x3F);
+            if((word >> 15) == 0) {
+                auto chan = (word >> 10) + 32*module;
+                auto time = word & 0x3FF;
+                ref.batch.addHit(chan + module*32, 8*time, 0);
+            } else {
+                ref.specials.back().push_back(buffer.at(i));
+            }
+            ++i;
+        }
+    }
+}
+
+static vector<uint32_t> randomStream(std::mt19937& rng, size_t size, unsigned markerRate) {
+    vector<uint32_t> data(size);
+    for(auto& word : data) {
+        word = rng();
+        if(word % markerRate == 0)
+            word = 0xFFFFFFFF;
+    }
+    return data;
+}
+
+static bool sameEvents(const Reference& ref, const EventBatch& batch) {
+    auto& a = ref.batch;
+    if(a.eventCount() != batch.eventCount() || a.hitCount() != batch.hitCount())
+        return false;
+    for(size_t e = 0; e < a.eventCount(); ++e) {
+        if(a.eventEnd(e) != batch.eventEnd(e) || a.trigger(e) != batch.trigger(e))
+            return false;
+        auto& specials = ref.specials[e];
+        if(batch.specialEnd(e) - batch.specialBegin(e) != specials.size() ||
+           batch.header(e).special != specials.size())
+            return false;
+        for(size_t k = 0; k < specials.size(); ++k) {
+            if(batch.special(batch.specialBegin(e) + k) != specials[k])
+                return false;
+        }
+    }
+    for(size_t h = 0; h < a.hitCount(); ++h) {
+        if(a.channel(h) != batch.channel(h) || a.time(h) != batch.time(h) || a.edge(h) != batch.edge(h))
+            return false;
+    }
+    return true;
+}
+
+int main() {
+    static constexpr int streams = 300;
+    static constexpr unsigned threadCounts[] = {1, 3, 8};
+    std::mt19937 rng(5);
+    //Декодеры переиспользуются между потоками данных, как в EmissTdc
+    vector<std::unique_ptr<EmissDecoder>> decoders;
+    for(int isa = 0; isa <= int(supportedSimdIsa()); ++isa)
+        decoders.emplace_back(new EmissDecoder(SimdIsa(isa)));
+
+    for(int s = 0; s < streams; ++s) {
+        //Каждый 50-й поток больше порога параллельного декодирования
+        size_t size = (s % 50 == 0) ? 300000 + rng() % 300000 : rng() % 400;
+        //Частые маркеры дают оборванные заголовки и пустые события
+        auto data = randomStream(rng, size, (s % 2) ? 6 : 97);
+        Reference ref;
+        uint32_t refNumber = 0;
+        decodeOld(data, refNumber, ref);
+        for(auto& decoder : decoders) {
+            for(auto threads : threadCounts) {
+                std::ostringstream what;
+                what << "stream " << s << " isa " << decoder->isa() << " threads " << threads;
+                decoder->setThreads(threads);
+                EventBatch batch;
+                uint32_t number = 0;
+                decoder->decodeEvents(data.data(), data.size(), 0, number, batch);
+                check(sameEvents(ref, batch), ("events differ: " + what.str()).c_str());
+                check(number == refNumber, ("event numbers differ: " + what.str()).c_str());
+            }
+        }
+    }
+    return checkResult("emissdecodertest");
+}